@@ -33,6 +33,8 @@
 #include <NTL/vec_ZZ_p.h>
 #include <cmath>
 #include <assert.h>   
+#include <utility>
+#include <vector>
 
 using namespace NTL;
 using namespace std;
@@ -273,6 +275,80 @@ vec_ZZ_p opt_decompress_encoding(const Vec<ZZ_p>& input, const size_t L)
    return decompressed;
 }
 
+// The input index pairs (a, b) that opt_decompress_encoding multiplies, in
+// output order. b = -1 marks an output that is input[a] itself.
+std::vector<std::pair<long,long>> decompress_encoding_pairs(const size_t L)
+{
+   std::vector<std::pair<long,long>> pairs;
+   size_t N;
+   N = 14*pow(L,2)+10*L-1; // the number of clients
+   pairs.reserve(N);
+   for (size_t i = 0 ; i < L ; i++){  // 1 ~ L (t-share)
+      pairs.emplace_back(i, -1);
+   }
+   for (size_t i = 0 ; i < L ; i++){  // L+1 ~ 2L (2t-share)
+      pairs.emplace_back(L-1, i);
+   }
+   for (size_t j = L ; j < 4*L ; j++){  // 2L+1 ~ 3L^2+2L 
+      for (size_t i = 0 ; i < L ; i++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   for (size_t j = 4*L ; j < 5*L ; j++){ // 3L^2+2L+1 ~ 4L^2+3L-1
+      if (j > 4*L){
+         pairs.emplace_back(j, -1);
+      }
+      for (size_t i = 0 ; i < L ; i++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   for (size_t i = 1 ; i < 2*L+2 ; i++ ){  // 4L^2+3L ~ 6L^2+4L-1
+      for (size_t j = 1 ; j < L+1 ; j++){
+         pairs.emplace_back((2*L-1)+i-j, 4*L+j-1);
+      }
+   }
+   for (size_t i = 5*L ; i < 6*L+1 ; i++){  // 6L^2+4L ~ 6L^2+5L
+      pairs.emplace_back(i, -1);
+   }
+   for (size_t i = 0 ; i < L ; i++){  // 6L^2+5L+1 ~ 6L^2+6L
+      pairs.emplace_back(i, 6*L);
+   }
+   for (size_t i = L ; i < 4*L ; i++){  // 6L^2+6L+1 ~ 9L^2+6L
+      for (size_t j = 5*L+1 ; j < 6*L+1 ; j++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   for (size_t j = 5*L+1 ; j < 6*L+1 ; j++){  // 9L^2+6L+1 ~ 9L^2+7L
+      pairs.emplace_back(4*L, j);
+   }
+   for (size_t i = 4*L+1 ; i < 5*L ; i++){  // 9L^2+7L+1 ~ 10L^2+7L-1
+      for (size_t j = 5*L ; j < 6*L+1 ; j++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   for (size_t i = 6*L+1 ; i < 7*L+2 ; i++){  // 10L^2+7L ~ 10L^2+8L
+      pairs.emplace_back(i, -1);
+   }
+   for (size_t i = 0 ; i < L ; i++){  // 10L^2+8L+1 ~ 10L^2+9L
+      pairs.emplace_back(i, 7*L+1);
+   }
+   for (size_t i = L ; i < 4*L ; i++){  // 10L^2+9L+1 ~ 13L^2+9L
+      for (size_t j = 6*L+2 ; j < 7*L+2 ; j++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   for (size_t i = 6*L+2 ; i < 7*L+2 ; i++){  // 13L^2+9L+1 ~ 13L^2+10L
+      pairs.emplace_back(4*L, i);
+   }
+   for (size_t i = 4*L+1 ; i < 5*L ; i++){  // 13L^2+10L+1 ~ 14L^2+10L-1
+      for (size_t j = 6*L+1 ; j < 7*L+2 ; j++){
+         pairs.emplace_back(i, j);
+      }
+   }
+   assert(pairs.size() == N);
+   return pairs;
+}
+
 // Input Format Verification Circuit
 ZZ_p verify_format(const Vec<ZZ_p>& coins, const Vec<ZZ_p>& input, const size_t L)
 {
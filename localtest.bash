@@ -32,16 +32,25 @@ set -E -e -u -o pipefail || exit $?
 trap exit ERR
 
 mkdir -p logs
+rm -f logs/results_*.csv logs/results_*.jsonl
 
 server_pids=()
-num_servers=5
+servers_per_committee=5
+committees=$(awk '$1 == "committees" {print $2}' configs/mix_config)
+num_servers=$((servers_per_committee * ${committees:-1}))
 
 for ((i = 1; i <= num_servers; ++i)); do
-  ./rm_server_main configs/mpc_config$i configs/mix_config configs/net_config &>logs/log$i.txt &
+  # servers beyond configs/mpc_config5 get a copy of mpc_config1 with their id
+  mpc_config=configs/mpc_config$i
+  if [[ ! -f $mpc_config ]]; then
+    mpc_config=logs/mpc_config$i
+    { head -n 2 configs/mpc_config1; echo $i; } >$mpc_config
+  fi
+  ./rm_server_main $mpc_config configs/mix_config configs/net_config "$@" &>logs/log$i.txt &
   server_pids+=($!)
 done
 
-./rm_client_main configs/mpc_config1 configs/mix_config configs/net_config &>logs/logclient.txt &
+./rm_client_main configs/mpc_config1 configs/mix_config configs/net_config "$@" &>logs/logclient.txt &
 client_pid=$!
 
 status=0
@@ -58,4 +67,19 @@ s=$?
 echo exit status $s >>logs/logclient.txt
 if ((!status && s)); then status=$s; fi
 
+# merge the per-party results into logs/results.csv and logs/results.json
+shopt -s nullglob
+csvs=(logs/results_*.csv)
+if ((${#csvs[@]})); then
+  head -n 1 "${csvs[0]}" >logs/results.csv
+  for f in "${csvs[@]}"; do
+    tail -n +2 "$f" >>logs/results.csv
+  done
+  {
+    echo "["
+    cat logs/results_*.jsonl | sed '$!s/$/,/'
+    echo "]"
+  } >logs/results.json
+fi
+
 exit $status
@@ -32,7 +32,11 @@
 #include "network_ts_queue.hpp"
 #include "network_message.hpp"
 #include "network_connection.hpp"
+#include "network_io_pool.hpp"
 #include <NTL/ZZ.h>
+#include <functional>
+#include <random>
+#include <thread>
 
 namespace rm_net
 {
@@ -43,14 +47,22 @@ namespace rm_net
       int local_partyID = -1;
       int remote_partyID = -1;
 
-      client_interface()
+      // connections run on pool, by default the process-wide shared_io_pool()
+      client_interface(io_pool& pool = shared_io_pool()) : my_pool(pool), my_context(pool.context())
       {
       }
 
       virtual ~client_interface()
       {
-        // when the client interface is destroyed, then it disconnects from server.
-        disconnect();
+        // when the client interface is destroyed, then it disconnects from
+        // server; the connection outlives this interface until the pool stops,
+        // so handlers still queued for it stay safe
+        if (pool_started)
+        {
+          my_connection->detach();
+          my_pool.retire(my_connection);
+          my_pool.stop();
+        }
       }
 
       // connect to server upon server's listening ip and port
@@ -63,31 +75,84 @@ namespace rm_net
           // create endpoints based on resolver on host/port
           auto my_endpoints = resolver.resolve(host, port);
 
+          // connect to server with the endpoint
+          boost::asio::ip::tcp::socket socket(my_context);
+          boost::asio::connect(socket, my_endpoints);
+
           // create a connection object
           my_connection = std::make_shared<connection>(
             connection::owner::client,
             my_context,
-            boost::asio::ip::tcp::socket(my_context),
+            std::move(socket),
             incoming_queue
           );
-
-          my_connection->local_partyID = local_partyID;
-          my_connection->remote_partyID = remote_partyID;
-
-          // connect to server with the endpoint
-          my_connection->connect_to_server(my_endpoints);
-
-          // start context thread
-          context_thread = std::thread([this]() {my_context.run();});
+          start_connection();
         }
         catch (std::exception& e)
         {
-          std::cerr << "Client Connection Error: " << e.what() << std::endl;
+          RM_LOG_DEBUG("Client Connection Error: " << e.what());
           return false;
         }
         return true;
       }
 
+      // Connect to the local endpoint of a server on this host (see
+      // server_interface::listen_local); slot is this party's server id, or 0
+      // for a client, which takes any free client slot. Messages received
+      // over shm: are delivered by poll().
+      bool connect_local(const std::string& endpoint, uint32_t slot)
+      {
+        if (endpoint.rfind("unix:", 0) == 0)
+        {
+          try
+          {
+            boost::asio::local::stream_protocol::socket socket(my_context);
+            socket.connect(boost::asio::local::stream_protocol::endpoint(endpoint.substr(5)));
+            return connect_transport(std::make_unique<stream_transport<boost::asio::local::stream_protocol::socket>>(std::move(socket)));
+          }
+          catch (std::exception& e)
+          {
+            RM_LOG_DEBUG("Client Connection Error: " << endpoint << ": " << e.what());
+            return false;
+          }
+        }
+        if (endpoint.rfind("shm:", 0) == 0)
+        {
+          std::unique_ptr<transport> link = shm_connect(endpoint.substr(4), slot);
+          if (!link)
+          {
+            RM_LOG_DEBUG("Client Connection Error: no free slot at " << endpoint);
+            return false;
+          }
+          return connect_transport(std::move(link));
+        }
+        RM_LOG_ERROR("Unknown local endpoint: " << endpoint);
+        return false;
+      }
+
+      // connect over an already established transport, such as one end of
+      // make_memory_link(); received messages are delivered by poll()
+      bool connect_transport(std::unique_ptr<transport> link)
+      {
+        my_connection = std::make_shared<connection>(
+          connection::owner::client,
+          my_context,
+          std::move(link),
+          incoming_queue
+        );
+        start_connection();
+        return true;
+      }
+
+      // deliver messages waiting in an in-memory or shared-memory transport
+      size_t poll()
+      {
+        if(my_connection)
+          return my_connection->poll();
+        else
+          return 0;
+      }
+
       // disconnect server
       void disconnect()
       {
@@ -95,13 +160,6 @@ namespace rm_net
         {
           my_connection->disconnect();
         }
-        // stop the io_context
-        my_context.stop();
-        // stop the thread
-        if(context_thread.joinable())
-          context_thread.join();
-        // release the pointer
-        //my_connection.release();
       }
 
       // return 1 if and only if a connection is valid
@@ -113,35 +171,141 @@ namespace rm_net
           return false;
       }
 
+      // total bytes sent to the server so far
+      uint64_t sent_bytes()
+      {
+        if(my_connection)
+          return my_connection->sent_bytes();
+        else
+          return 0;
+      }
+
+      // counters of the connection to the server
+      connection_stats stats()
+      {
+        if(my_connection)
+          return my_connection->stats();
+        else
+          return connection_stats();
+      }
+
       // return 1 if and only if the incoming queue is empty
       bool is_incoming_empty()
       {
         return incoming_queue.is_empty();
       }
 
+      // blocks while the connection's send budget is used up
       void send_message(const message& msg)
 			{
 				if (is_connected())
 					 my_connection->send_message(msg); 
 			}
 
+      // as above, moving msg's body into the outgoing queue
+      void send_message(message&& msg)
+      {
+        if (is_connected())
+          my_connection->send_message(std::move(msg));
+      }
+
+      // false if the message does not fit in the send budget right now
+      bool try_send_message(const message& msg)
+      {
+        return is_connected() && my_connection->try_send_message(msg);
+      }
+
+      bool try_send_message(message&& msg)
+      {
+        return is_connected() && my_connection->try_send_message(std::move(msg));
+      }
+
+      // bytes that may wait in the outgoing queue (0 = unbounded); applies to later connections too
+      void set_send_budget(uint64_t bytes)
+      {
+        send_budget = bytes;
+        if (my_connection)
+          my_connection->set_send_budget(bytes);
+      }
+
       async_queue<received_message>& access_to_incoming_queue()
       {
         return incoming_queue;
       }
 
     protected:
-      // asio io context
-      boost::asio::io_context my_context;
-      
-      // thread for its own work in context
-      std::thread context_thread;
+      void start_connection()
+      {
+        my_connection->local_partyID = local_partyID;
+        my_connection->remote_partyID = remote_partyID;
+        my_connection->set_send_budget(send_budget);
+        my_connection->connect_to_server();
+        if (!pool_started)
+        {
+          my_pool.start(); // stopped again by the destructor
+          pool_started = true;
+        }
+      }
+
+      // the threads running this client's connection
+      io_pool& my_pool;
+
+      // asio io context, owned by my_pool
+      boost::asio::io_context& my_context;
       
       // connection pointer (as a shared pointer)
       std::shared_ptr<connection> my_connection;
 
+      uint64_t send_budget = 0;
+
+      bool pool_started = false;
+
     private: // needs to be private?
       // queue owned by the client 
       async_queue<received_message> incoming_queue;
   };
+  // retry schedule of connect_all: the n-th retry waits a uniformly random
+  // time up to min(initial * 2^n, max)
+  struct connect_backoff
+  {
+    std::chrono::milliseconds initial{10};
+    std::chrono::milliseconds max{1000};
+  };
+
+  // Make attempt(i) succeed for every i < count, all peers in parallel, each
+  // retrying with jittered exponential backoff. Returns once all have
+  // succeeded, so it doubles as the readiness barrier of a mesh. Peers that
+  // are not up yet are expected at startup, so only the first failure of
+  // each is a warning.
+  void connect_all(size_t count, const std::function<bool(size_t)>& attempt, const connect_backoff& backoff = connect_backoff())
+  {
+    auto connect_one = [&](size_t i)
+    {
+      std::mt19937_64 rng(std::random_device{}());
+      std::chrono::milliseconds delay = backoff.initial;
+      for (size_t tries = 1 ; !attempt(i) ; tries++)
+      {
+        if (tries == 1)
+        {
+          RM_LOG_WARN("Peer " << i << " is not reachable yet, retrying");
+        }
+        else
+        {
+          RM_LOG_DEBUG("Peer " << i << " is still not reachable after " << tries << " attempts");
+        }
+        std::uniform_int_distribution<long> jitter(0, delay.count());
+        std::this_thread::sleep_for(std::chrono::milliseconds(jitter(rng)));
+        delay = std::min(delay * 2, backoff.max);
+      }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0 ; i != count ; i++)
+    {
+      workers.emplace_back(connect_one, i);
+    }
+    for (auto& w : workers)
+    {
+      w.join();
+    }
+  }
 }
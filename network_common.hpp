@@ -36,6 +36,8 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <atomic>
+#include <condition_variable>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ts/buffer.hpp>
@@ -32,9 +32,89 @@
 #include "network_common.hpp"
 #include "network_ts_queue.hpp"
 #include "network_message.hpp"
+#include "network_transport.hpp"
+#include "rm_metrics.hpp"
+#include "rm_log.hpp"
+#include <future>
 
 namespace rm_net
 {
+  // count, sum and max of a latency in microseconds, updated lock-free
+  struct latency_counter
+  {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+
+    void add(int64_t us)
+    {
+      uint64_t v = us > 0 ? static_cast<uint64_t>(us) : 0;
+      count.fetch_add(1, std::memory_order_relaxed);
+      sum_us.fetch_add(v, std::memory_order_relaxed);
+      uint64_t m = max_us.load(std::memory_order_relaxed);
+      while (v > m && !max_us.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    }
+  };
+
+  // a plain copy of a latency_counter in milliseconds
+  struct latency_summary
+  {
+    uint64_t count = 0;
+    double mean_ms = 0;
+    double max_ms = 0;
+
+    latency_summary() {}
+    latency_summary(const latency_counter& c)
+    {
+      count = c.count.load(std::memory_order_relaxed);
+      mean_ms = count ? c.sum_us.load(std::memory_order_relaxed) / 1000.0 / count : 0;
+      max_ms = c.max_us.load(std::memory_order_relaxed) / 1000.0;
+    }
+  };
+
+  // traffic received for one mixing state
+  struct state_traffic
+  {
+    uint16_t state = 0;
+    uint64_t bytes_in = 0;
+    uint64_t msgs_in = 0;
+    latency_summary one_way; // sender's header.time to arrival; needs synchronized clocks across hosts
+  };
+
+  // a snapshot of one connection's counters
+  struct connection_stats
+  {
+    uint32_t id = 0;
+    int local_partyID = -1;
+    int remote_partyID = -1;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t msgs_in = 0;
+    uint64_t msgs_out = 0;
+    uint64_t queue_depth = 0;
+    uint64_t queue_high_water = 0;
+    uint64_t queued_bytes = 0;
+    uint64_t blocked_sends = 0; // sends that waited for the byte budget
+    latency_summary write_latency; // enqueue in send_message to write completion
+    std::vector<state_traffic> states; // only states that received traffic
+
+    friend std::ostream& operator << (std::ostream& os, const connection_stats& s)
+    {
+      os << "[NET] conn " << s.id << " (" << s.local_partyID << "->" << s.remote_partyID << ")"
+         << " out " << s.bytes_out << " B/" << s.msgs_out << " msgs"
+         << ", in " << s.bytes_in << " B/" << s.msgs_in << " msgs"
+         << ", queue " << s.queue_depth << " (max " << s.queue_high_water << ", " << s.queued_bytes << " B)"
+         << ", blocked " << s.blocked_sends
+         << ", write " << s.write_latency.mean_ms << " ms (max " << s.write_latency.max_ms << ")";
+      for (auto& st : s.states)
+      {
+        os << ", state " << st.state << ": " << st.bytes_in << " B/" << st.msgs_in << " msgs, "
+           << st.one_way.mean_ms << " ms (max " << st.one_way.max_ms << ")";
+      }
+      return os;
+    }
+  };
+
   class connection : public std::enable_shared_from_this<connection>
   {
     public:
@@ -47,14 +127,31 @@ namespace rm_net
       int local_partyID = -1;
       int remote_partyID = -1;
 
-      // constructor
+      // takes a received message on the thread that read it; returning false
+      // leaves the message to the incoming queue
+      using receive_hook = std::function<bool(const std::shared_ptr<connection>&, message&)>;
+
+      // constructor over a connected (or accepted) TCP socket
       connection(owner parent, 
                  boost::asio::io_context& asioContext, 
                  boost::asio::ip::tcp::socket socket,
                  async_queue<received_message>& rec_messages)
-      : context(asioContext), socket(std::move(socket)), incoming_queue(rec_messages)
+      : connection(parent,
+                   asioContext,
+                   std::make_unique<stream_transport<boost::asio::ip::tcp::socket>>(std::move(socket)),
+                   rec_messages)
+      {
+      }
+
+      // constructor over any transport
+      connection(owner parent, 
+                 boost::asio::io_context& asioContext, 
+                 std::unique_ptr<transport> link,
+                 async_queue<received_message>& rec_messages)
+      : context(asioContext), strand(boost::asio::make_strand(asioContext)), conn_transport(std::move(link)), incoming_queue(rec_messages)
       {
         owner_type = parent;
+        conn_transport->attach(strand);
       }
 
       // destructor
@@ -71,21 +168,20 @@ namespace rm_net
       {
         if(owner_type == owner::server)
         {
-          if(socket.is_open())
+          if(is_connected())
           {
             id = uid;
-            boost::asio::post(context, [this]() { read_header(); });
+            boost::asio::post(strand, [this]() { start_reading(); });
           }
         }
       }
 
-      // connect to a server with endpoints
-      void connect_to_server(const boost::asio::ip::tcp::resolver::results_type& endpoints)
+      // start receiving from a server once the transport is connected
+      void connect_to_server()
       {
         if (owner_type == owner::client)
         {
-          boost::asio::connect(socket, endpoints);
-          boost::asio::post(context, [this]() { read_header(); });
+          boost::asio::post(strand, [this]() { start_reading(); });
         }
       }
 
@@ -94,168 +190,292 @@ namespace rm_net
       {
         if (is_connected())
         {
-          boost::asio::post(context,
+          boost::asio::post(strand,
           [this]()
           {
-            socket.close();
+            conn_transport->close();
           });
         }
       }
 
       bool is_connected() const
       {
-        return socket.is_open();
+        return conn_transport->is_open();
       }
 
-    public:
-      void send_message(const message& msg)
+      // Close the connection and stop delivering to the incoming queue and the
+      // receive hook, whose owner is going away. Waits for the strand, so it
+      // must be called while the pool runs and not from a pool thread.
+      void detach()
       {
-        outgoing_queue.push_back(msg);
-        boost::asio::post(context, [this]() { write_header(); });
+        std::promise<void> done;
+        boost::asio::post(strand, [this, &done]()
+        {
+          detached = true;
+          conn_transport->close();
+          done.set_value();
+        });
+        done.get_future().wait();
       }
 
-    private:
+      // set before connect_to_client() or connect_to_server()
+      void set_receive_hook(receive_hook hook)
+      {
+        on_receive = std::move(hook);
+      }
 
-    // asio - read a message header
-    void read_header()
-    {
-      boost::asio::async_read(
-            socket, 
-            boost::asio::buffer(&temp_msg.header, sizeof(message_header)),
-      [this](std::error_code ec, std::size_t lenght)
+      // deliver messages waiting in an in-memory transport; returns how many
+      size_t poll()
+      {
+        return conn_transport->poll();
+      }
+
+      // total bytes written to the transport so far
+      uint64_t sent_bytes() const
+      {
+        return bytes_sent;
+      }
+
+      // a snapshot of this connection's counters, safe to take from any thread
+      connection_stats stats() const
       {
-        if(!ec)
+        connection_stats s;
+        s.id = id;
+        s.local_partyID = local_partyID;
+        s.remote_partyID = remote_partyID;
+        s.bytes_in = bytes_received.load(std::memory_order_relaxed);
+        s.bytes_out = bytes_sent.load(std::memory_order_relaxed);
+        s.msgs_in = msgs_received.load(std::memory_order_relaxed);
+        s.msgs_out = msgs_sent.load(std::memory_order_relaxed);
+        s.queue_depth = queue_depth.load(std::memory_order_relaxed);
+        s.queue_high_water = queue_high_water.load(std::memory_order_relaxed);
+        s.queued_bytes = queued_bytes.load(std::memory_order_relaxed);
+        s.blocked_sends = blocked_sends.load(std::memory_order_relaxed);
+        s.write_latency = latency_summary(write_latency);
+        for (size_t i = 0 ; i != max_states ; i++)
         {
-          if (temp_msg.header.size > 0)
+          uint64_t msgs = state_msgs_in[i].load(std::memory_order_relaxed);
+          if (msgs != 0)
           {
-            temp_msg.body.resize(temp_msg.header.size);
-            read_body();
+            state_traffic st;
+            st.state = static_cast<uint16_t>(i);
+            st.bytes_in = state_bytes_in[i].load(std::memory_order_relaxed);
+            st.msgs_in = msgs;
+            st.one_way = latency_summary(state_one_way[i]);
+            s.states.push_back(st);
           }
-          else
+        }
+        return s;
+      }
+
+    public:
+      // Bytes of queued messages allowed before send_message() blocks and
+      // try_send_message() refuses; 0 leaves the queue unbounded. A message
+      // larger than the budget is still sent once the queue is empty.
+      void set_send_budget(uint64_t bytes)
+      {
+        send_budget = bytes;
+      }
+
+      // queue a copy of msg, first waiting while the byte budget is used up;
+      // must not be called from an io thread
+      void send_message(const message& msg)
+      {
+        send_message(message(msg));
+      }
+
+      // as above, taking over msg's body instead of copying it
+      void send_message(message&& msg)
+      {
+        uint64_t length = msg.size();
+        if (!reserve_budget(length))
+        {
+          blocked_sends.fetch_add(1, std::memory_order_relaxed);
+          blocked_counter.inc();
+          auto start = std::chrono::steady_clock::now();
+          std::unique_lock<std::mutex> lock(budget_mtx);
+          while (!reserve_budget(length))
           {
-            Add_to_Incoming_Queue();
+            if (!is_connected())
+            {
+              RM_LOG_WARN("[" << id << "] dropped a message for a closed connection");
+              return;
+            }
+            budget_cv.wait_for(lock, std::chrono::milliseconds(10));
           }
+          blocked_hist.observe(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
         }
-        else
+        enqueue(std::move(msg));
+      }
+
+      // queue a copy of msg only if it fits in the byte budget
+      bool try_send_message(const message& msg)
+      {
+        if (!reserve_budget(msg.size()))
         {
-          std::cout << "[" << id << "] Reading header failed.\n";
-          socket.close();
+          rejected_counter.inc();
+          return false;
         }
-      });
-    }
+        enqueue(message(msg));
+        return true;
+      }
 
-    // asio - read a message body
-    void read_body()
-    {
-      boost::asio::async_read(
-            socket,
-            boost::asio::buffer(temp_msg.body.data(),temp_msg.header.size),
-      [this](std::error_code ec, std::size_t length)
+      // as above, taking over msg's body if it fits; msg is left as is otherwise
+      bool try_send_message(message&& msg)
       {
-        if (!ec)
+        if (!reserve_budget(msg.size()))
         {
-          Add_to_Incoming_Queue();
+          rejected_counter.inc();
+          return false;
         }
-        else
+        enqueue(std::move(msg));
+        return true;
+      }
+
+    private:
+      // take length bytes of the budget, if they fit
+      bool reserve_budget(uint64_t length)
+      {
+        uint64_t budget = send_budget.load(std::memory_order_relaxed);
+        uint64_t queued = queued_bytes.load(std::memory_order_relaxed);
+        do
         {
-          std::cout << "[" << id << "] Reading body failed.\n";
-          socket.close();
-        }
-      });
+          if (budget != 0 && queued != 0 && queued + length > budget)
+          {
+            return false;
+          }
+        } while (!queued_bytes.compare_exchange_weak(queued, queued + length, std::memory_order_relaxed));
+        queued_gauge.add(length);
+        return true;
+      }
+
+      // queue msg stamped with the current time
+      void enqueue(message&& msg)
+      {
+        msg.header.time = std::chrono::system_clock::now();
+        outgoing_queue.push_back(std::move(msg));
+        outgoing_depth.add(1);
+        uint64_t depth = queue_depth.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t high = queue_high_water.load(std::memory_order_relaxed);
+        while (depth > high && !queue_high_water.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {}
+        boost::asio::post(strand, [this]() { write_message(); });
+      }
+
+    private:
+
+    void start_reading()
+    {
+      conn_transport->start_reading(
+        [this](message& msg) { Add_to_Incoming_Queue(msg); },
+        [this](const char* what)
+        {
+          RM_LOG_WARN("[" << id << "] " << what);
+          conn_transport->close();
+        });
     }
 
-    // asio - write a message header
-    void write_header() 
+    // write the next queued message, one at a time
+    void write_message()
     {
       if (already_writing_ || outgoing_queue.is_empty()) {
         return;
       }
       already_writing_ = true;
-      boost::asio::async_write(
-        socket, 
-        boost::asio::buffer(&outgoing_queue.front().header, 
-        sizeof(message_header)),
-        [this](std::error_code ec, std::size_t length)
+      writing_msg = outgoing_queue.pop_front();
+      uint32_t body_size = writing_msg.header.size;
+      uint64_t queued_length = writing_msg.size();
+      auto sent_time = writing_msg.header.time;
+      conn_transport->write(writing_msg,
+        [this, body_size, queued_length, sent_time](std::error_code ec, std::size_t length)
         {
           if(!ec)
           {
-            std::stringstream s;
-            s << "[TEST HEADER]:" << local_partyID << "->" << remote_partyID << ": " << length << "\n";
-            std::cout << s.str();
-            if(outgoing_queue.front().header.size > 0)
+            bytes_sent += length;
+            sent_counter.inc(length);
+            RM_LOG_TRACE("[TEST HEADER]:" << local_partyID << "->" << remote_partyID << ": " << sizeof(message_header));
+            if (body_size > 0)
             {
-              write_body();
-            }
-            else
-            {
-              outgoing_queue.pop_front();
-              already_writing_ = false;
-              write_header();
+              RM_LOG_TRACE("[TEST BODY]:" << local_partyID << "->" << remote_partyID << ": " << body_size);
             }
+            write_completed(sent_time, queued_length);
+            write_message();
           }
           else
           {
-            std::cout << "[" << id << "] writing header failed. \n";
-            socket.close();
+            RM_LOG_WARN("[" << id << "] writing message failed. ");
+            conn_transport->close();
           }
-        }
-      );
+        });
     }
 
-    // asio - write a message body
-    void write_body()
+    // account for the message that has just been written
+    void write_completed(std::chrono::system_clock::time_point sent_time, uint64_t queued_length)
     {
-      boost::asio::async_write(
-        socket, 
-        boost::asio::buffer(outgoing_queue.front().body.data(), 
-        outgoing_queue.front().header.size),
-        [this](std::error_code ec, std::size_t length)
-        {
-          if(!ec)
-          {
-            std::stringstream s;
-            s << "[TEST BODY]:" << local_partyID << "->" << remote_partyID << ": " << length << "\n";
-            std::cout << s.str();
-            outgoing_queue.pop_front();
-            already_writing_ = false;
-            write_header();
-          }
-          else
-          {
-            std::cout << "[" << id << "] writing body failed. \n";
-            socket.close();
-          }
-        }
-      );
+      auto lapsed = std::chrono::system_clock::now() - sent_time;
+      write_latency.add(std::chrono::duration_cast<std::chrono::microseconds>(lapsed).count());
+      msgs_sent.fetch_add(1, std::memory_order_relaxed);
+      outgoing_depth.add(-1);
+      queue_depth.fetch_sub(1, std::memory_order_relaxed);
+      queued_bytes.fetch_sub(queued_length, std::memory_order_relaxed);
+      queued_gauge.add(-static_cast<int64_t>(queued_length));
+      if (send_budget.load(std::memory_order_relaxed) != 0)
+      {
+        std::scoped_lock lock(budget_mtx);
+        budget_cv.notify_all();
+      }
+      already_writing_ = false;
     }
 
-    void Add_to_Incoming_Queue()
+    // account for a received message and move it to the incoming queue
+    void Add_to_Incoming_Queue(message& msg)
     {
+      if (detached)
+      {
+        return;
+      }
+      size_t state = std::min<size_t>(msg.header.mixing_state_id, max_states - 1);
+      uint64_t length = sizeof(message_header) + msg.header.size;
+      auto lapsed = std::chrono::system_clock::now() - msg.header.time;
+      bytes_received.fetch_add(length, std::memory_order_relaxed);
+      msgs_received.fetch_add(1, std::memory_order_relaxed);
+      state_bytes_in[state].fetch_add(length, std::memory_order_relaxed);
+      state_msgs_in[state].fetch_add(1, std::memory_order_relaxed);
+      state_one_way[state].add(std::chrono::duration_cast<std::chrono::microseconds>(lapsed).count());
+
+      if (on_receive && on_receive(this->shared_from_this(), msg))
+      {
+        return;
+      }
       received_message temp;
       temp.conn = this->shared_from_this();
-      temp.msg = temp_msg;
-      incoming_queue.push_back(temp);
-
-      // now after adding a msg to queue, read header again
-      read_header();
+      temp.msg = std::move(msg);
+      incoming_queue.push_back(std::move(temp));
     }
 
     protected:
-      boost::asio::ip::tcp::socket socket;
-
       // the context is provided by clients/servers and shared with the entire asio instance
       boost::asio::io_context& context; 
 
+      // runs every handler of this connection, one at a time
+      conn_executor strand;
+
+      // how messages reach the other party
+      std::unique_ptr<transport> conn_transport;
+
+      // optional handler that takes received messages before the incoming queue
+      receive_hook on_receive;
+      std::atomic<bool> detached{false}; // the queue's owner is gone
+
       // the queue containing all messages to be sent via this connection
       async_queue<message> outgoing_queue;
 
+      // the message currently being written
+      message writing_msg;
+
       // the queue holding all messages received from this connection.
       // the queue will be provided by its client/server.
       async_queue<received_message>& incoming_queue;
 
-      // temporary message variable
-      message temp_msg;
-
       // two types
       owner owner_type = owner::server;
 
@@ -263,5 +483,34 @@ namespace rm_net
       uint32_t id = 0;
 
       bool already_writing_ = false;
+
+      std::atomic<uint64_t> bytes_sent{0};
+
+      // per-connection counters, read by stats()
+      static constexpr size_t max_states = 64; // state ids above are counted in the last slot
+      std::atomic<uint64_t> bytes_received{0};
+      std::atomic<uint64_t> msgs_received{0};
+      std::atomic<uint64_t> msgs_sent{0};
+      std::atomic<uint64_t> queue_depth{0};
+      std::atomic<uint64_t> queue_high_water{0};
+      latency_counter write_latency;
+      std::atomic<uint64_t> queued_bytes{0};
+      std::atomic<uint64_t> blocked_sends{0};
+      std::atomic<uint64_t> state_bytes_in[max_states] = {};
+      std::atomic<uint64_t> state_msgs_in[max_states] = {};
+      latency_counter state_one_way[max_states];
+
+      // process-wide metrics shared by all connections
+      metric_counter& sent_counter = rm_metrics().counter("rm_bytes_sent_total", "Bytes written to sockets");
+      metric_gauge& outgoing_depth = rm_metrics().gauge("rm_queue_depth", "Messages waiting in a queue", "queue=\"outgoing\"");
+      metric_gauge& queued_gauge = rm_metrics().gauge("rm_queued_bytes", "Bytes of messages waiting to be written");
+      metric_counter& blocked_counter = rm_metrics().counter("rm_send_blocked_total", "Sends that waited for a connection's byte budget");
+      metric_histogram& blocked_hist = rm_metrics().histogram("rm_send_blocked_ms", "Time a send waited for a connection's byte budget");
+      metric_counter& rejected_counter = rm_metrics().counter("rm_send_rejected_total", "try_send_message calls refused by a connection's byte budget");
+
+      // the send budget, and what blocked senders wait on
+      std::atomic<uint64_t> send_budget{0};
+      std::mutex budget_mtx;
+      std::condition_variable budget_cv;
   };
 }
@@ -0,0 +1,135 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+
+#include "network_common.hpp"
+#include "rm_log.hpp"
+
+namespace rm_net
+{
+  // per-connection serialization of handlers on a shared io_context
+  using conn_executor = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+  // One io_context run by a fixed number of threads and shared by every
+  // client and server connection of the process. Each connection runs its
+  // handlers on its own strand, so handlers of one connection never overlap.
+  // Clients and servers start() and stop() the pool in pairs; it runs while
+  // any of them does.
+  class io_pool
+  {
+    public:
+      io_pool() = default;
+
+      ~io_pool()
+      {
+        std::scoped_lock lock(mtx);
+        shut_down();
+      }
+
+      // number of threads used by start(); has no effect while running
+      void configure(size_t count)
+      {
+        std::scoped_lock lock(mtx);
+        num_threads = std::max<size_t>(count, 1);
+      }
+
+      // register a user of the pool, starting the threads for the first one
+      void start()
+      {
+        std::scoped_lock lock(mtx);
+        if (users++ != 0)
+        {
+          return;
+        }
+        my_context.restart();
+        work_guard.emplace(my_context.get_executor());
+        for (size_t i = 0 ; i != num_threads ; i++)
+        {
+          threads.emplace_back([this]() { my_context.run(); });
+        }
+        RM_LOG_DEBUG("I/O pool started with " << num_threads << " threads");
+      }
+
+      // unregister a user started before; the last one stops and joins the
+      // threads. Must not be called from a pool thread.
+      void stop()
+      {
+        std::scoped_lock lock(mtx);
+        if (users == 0 || --users != 0)
+        {
+          return;
+        }
+        shut_down();
+      }
+
+      // keep obj alive until the threads stop, for objects whose handlers may still be queued
+      void retire(std::shared_ptr<void> obj)
+      {
+        std::scoped_lock lock(mtx);
+        retired.push_back(std::move(obj));
+      }
+
+      boost::asio::io_context& context() { return my_context; }
+
+      size_t size() const { return num_threads; }
+
+    private:
+      void shut_down()
+      {
+        work_guard.reset();
+        my_context.stop();
+        for (auto& t : threads)
+        {
+          if (t.joinable())
+            t.join();
+        }
+        threads.clear();
+        // run what the users left queued, such as aborted reads, while their objects are alive
+        my_context.restart();
+        my_context.poll();
+        retired.clear();
+      }
+
+      boost::asio::io_context my_context;
+      std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard; // set while running
+      std::vector<std::thread> threads;
+      std::vector<std::shared_ptr<void>> retired;
+      std::mutex mtx;
+      size_t num_threads = 2;
+      size_t users = 0; // started and not yet stopped
+  };
+
+  // the pool used by clients and servers unless they are given another one
+  io_pool& shared_io_pool()
+  {
+    static io_pool pool;
+    return pool;
+  }
+}
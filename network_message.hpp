@@ -34,6 +34,8 @@
 #include <NTL/vector.h>
 #include <NTL/vec_ZZ_p.h>
 #include <NTL/vec_vec_ZZ_p.h>
+#include <map>
+#include <tuple>
 
 
 namespace rm_net
@@ -165,5 +167,58 @@ namespace rm_net
     uint16_t tot_num_blocks; // if not 1, there are multiple blocks of messages for the mixing state id.
     std::shared_ptr<connection> conn = nullptr; // sender's connection (to be used only to send back a message to clients)
     NTL::vec_vec_ZZ_p body;
+    uint16_t num_ZZ_p = 0; // the number of ZZ_p elements in raw
+    std::vector<unsigned char> raw; // undecoded client submission body, copied straight into the input share matrix
+    bool in_place = false; // body was decoded straight into a buffer registered in receive_buffers
+  };
+
+  // Destinations registered by a session for the payload of one
+  // (sid, state, pass, sender), the pass being the message's block index:
+  // element i of the payload is decoded straight into *elems[i]. An entry is
+  // used by at most one message. The session must not touch the destinations
+  // until that message's deserialized_message reaches it, and must remove a
+  // round's entries before reusing or freeing them.
+  class receive_buffers
+  {
+    public:
+      void add(uint32_t sid, uint16_t state, uint16_t pass, uint32_t sender, std::vector<NTL::ZZ_p*> elems)
+      {
+        std::scoped_lock lock(mtx);
+        entries[std::make_tuple(sid, state, pass, sender)] = std::move(elems);
+      }
+
+      // remove the entry of msg's (sid, state, pass, sender) into elems, if any
+      bool take(const message_header& header, std::vector<NTL::ZZ_p*>& elems)
+      {
+        std::scoped_lock lock(mtx);
+        auto it = entries.find(std::make_tuple(header.sid, header.mixing_state_id, header.block_idx, header.sender_id));
+        if (it == entries.end())
+        {
+          return false;
+        }
+        elems = std::move(it->second);
+        entries.erase(it);
+        return true;
+      }
+
+      // remove the entries of every pass and sender of (sid, state), including
+      // those left by peers whose message went through the queue
+      void remove_round(uint32_t sid, uint16_t state)
+      {
+        std::scoped_lock lock(mtx);
+        entries.erase(entries.lower_bound(std::make_tuple(sid, state, uint16_t(0), uint32_t(0))),
+                      entries.lower_bound(std::make_tuple(sid, uint16_t(state + 1), uint16_t(0), uint32_t(0))));
+      }
+
+      void remove_session(uint32_t sid)
+      {
+        std::scoped_lock lock(mtx);
+        entries.erase(entries.lower_bound(std::make_tuple(sid, uint16_t(0), uint16_t(0), uint32_t(0))),
+                      entries.lower_bound(std::make_tuple(sid + 1, uint16_t(0), uint16_t(0), uint32_t(0))));
+      }
+
+    private:
+      std::mutex mtx;
+      std::map<std::tuple<uint32_t,uint16_t,uint16_t,uint32_t>, std::vector<NTL::ZZ_p*>> entries;
   };
 }
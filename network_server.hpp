@@ -32,6 +32,7 @@
 #include "network_ts_queue.hpp"
 #include "network_message.hpp"
 #include "network_connection.hpp"
+#include "network_io_pool.hpp"
 
 namespace rm_net
 {
@@ -39,7 +40,15 @@ namespace rm_net
   {
     public:
       // constructor
-      server_interface(uint16_t port): my_acceptor(my_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(),port))
+      server_interface(uint16_t port, io_pool& pool = shared_io_pool())
+      : my_pool(pool), my_context(pool.context()),
+        my_acceptor(my_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(),port))
+      {
+
+      }
+
+      // a server without a listening socket, reached only through accept_transport()
+      server_interface(io_pool& pool = shared_io_pool()): my_pool(pool), my_context(pool.context()), my_acceptor(my_context)
       {
 
       }
@@ -54,30 +63,69 @@ namespace rm_net
       {
         try
         {
-          wait_for_connection();
-          my_thread = std::thread([this]() { my_context.run(); });
+          if (my_acceptor.is_open())
+          {
+            wait_for_connection();
+          }
+          if (!pool_started)
+          {
+            my_pool.start(); // stopped again by stop()
+            pool_started = true;
+          }
         }
         catch (std::exception& e)
         {
-          std::cerr << "Server exception thrown: " << e.what() << std::endl;
+          RM_LOG_ERROR("Server exception thrown: " << e.what());
           return false;
         }
-        std::cout << "Server started ..." << std::endl;
+        RM_LOG_INFO("Server started ...");
         return true;
       }
 
+      // Close the acceptors and every connection and wait for their handlers;
+      // the pool keeps running for its other users.
       void stop()
       {
-        my_context.stop();
-        if(my_thread.joinable())
-          my_thread.join();
+        if (stopped)
+        {
+          return;
+        }
+        if (!pool_started)
+        {
+          my_pool.start(); // acceptors armed by listen_local() need the pool to wind down
+          pool_started = true;
+        }
+        {
+          std::scoped_lock lock(accept_mtx);
+          stopped = true;
+          boost::system::error_code ec;
+          my_acceptor.close(ec);
+          if (local_acceptor)
+            local_acceptor->close(ec);
+        }
+        while (pending_accepts.load() != 0)
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::deque<std::shared_ptr<connection>> conns;
+        {
+          std::scoped_lock lock(connections_mtx);
+          conns.swap(my_connections);
+        }
+        for (auto& conn : conns)
+        {
+          conn->detach();
+          my_pool.retire(conn);
+        }
+        my_pool.stop();
 
-        std::cout << "Server terminated ..." << std::endl;
+        RM_LOG_INFO("Server terminated ...");
       }
 
       // asio - wait for connection
       void wait_for_connection()
       {
+        pending_accepts++;
         my_acceptor.async_accept(
           [this](std::error_code ec, boost::asio::ip::tcp::socket socket)
           {
@@ -86,7 +134,7 @@ namespace rm_net
               /** OPTION For NO_DELAY **/
               boost::asio::ip::tcp::no_delay option(true);
               socket.set_option(option);
-              std::cout << "Accepted connection: " << socket.remote_endpoint() << std::endl;
+              RM_LOG_INFO("Accepted connection: " << socket.remote_endpoint());
               std::shared_ptr<connection> newconn = 
                     std::make_shared<connection>(connection::owner::server, 
                                                  my_context, 
@@ -95,24 +143,113 @@ namespace rm_net
 
               if (upon_connection(newconn))
               {
+                std::scoped_lock lock(connections_mtx);
                 my_connections.push_back(std::move(newconn));
+                my_connections.back()->set_receive_hook(decode_hook());
                 my_connections.back()->connect_to_client(id_counter++);
-                std::cout << "[" << my_connections.back()->GetID() << "] connection established\n";
+                RM_LOG_INFO("[" << my_connections.back()->GetID() << "] connection established");
               }
               else
               {
-                std::cout << "** Connection denied" << std::endl;
+                RM_LOG_WARN("** Connection denied");
               }
             }
-            else
+            else if (!stopped)
             {
-              std::cout << "New connection error: " << ec.message() << std::endl;
+              RM_LOG_WARN("New connection error: " << ec.message());
             }
-            wait_for_connection();
+            {
+              std::scoped_lock lock(accept_mtx);
+              if (!stopped)
+                wait_for_connection();
+            }
+            pending_accepts--;
           }
           );
       }
 
+      // Also listen on a local endpoint for parties on this host:
+      // unix:<path> is a Unix-domain socket, shm:<name> a shared-memory segment
+      // with one slot per party id below party_slots and client_slots more
+      // for clients.
+      bool listen_local(const std::string& endpoint, uint32_t party_slots, uint32_t client_slots = 16)
+      {
+        if (endpoint.rfind("unix:", 0) == 0)
+        {
+          try
+          {
+            std::string path = endpoint.substr(5);
+            ::unlink(path.c_str());
+            local_acceptor.emplace(my_context, boost::asio::local::stream_protocol::endpoint(path));
+          }
+          catch (std::exception& e)
+          {
+            RM_LOG_ERROR("Listening on " << endpoint << " failed: " << e.what());
+            return false;
+          }
+          wait_for_local_connection();
+        }
+        else if (endpoint.rfind("shm:", 0) == 0)
+        {
+          shm_listener = shm_segment::create(endpoint.substr(4), party_slots, client_slots);
+          if (!shm_listener)
+          {
+            RM_LOG_ERROR("Creating shared memory for " << endpoint << " failed");
+            return false;
+          }
+        }
+        else
+        {
+          RM_LOG_ERROR("Unknown local endpoint: " << endpoint);
+          return false;
+        }
+        RM_LOG_INFO("Listening on " << endpoint);
+        return true;
+      }
+
+      // asio - wait for a connection on the Unix-domain socket
+      void wait_for_local_connection()
+      {
+        pending_accepts++;
+        local_acceptor->async_accept(
+          [this](std::error_code ec, boost::asio::local::stream_protocol::socket socket)
+          {
+            if(!ec)
+            {
+              RM_LOG_INFO("Accepted local connection");
+              accept_transport(std::make_unique<stream_transport<boost::asio::local::stream_protocol::socket>>(std::move(socket)));
+            }
+            else if (!stopped)
+            {
+              RM_LOG_WARN("New local connection error: " << ec.message());
+            }
+            {
+              std::scoped_lock lock(accept_mtx);
+              if (!stopped)
+                wait_for_local_connection();
+            }
+            pending_accepts--;
+          });
+      }
+
+      // accept a party over an already established transport, such as one end
+      // of make_memory_link()
+      void accept_transport(std::unique_ptr<transport> link)
+      {
+        std::shared_ptr<connection> newconn =
+              std::make_shared<connection>(connection::owner::server,
+                                           my_context,
+                                           std::move(link),
+                                           my_received_messages);
+        if (upon_connection(newconn))
+        {
+          std::scoped_lock lock(connections_mtx);
+          my_connections.push_back(std::move(newconn));
+          my_connections.back()->set_receive_hook(decode_hook());
+          my_connections.back()->connect_to_client(id_counter++);
+        }
+      }
+
       // send a message to a client - RM does not need for now
       void send_message_to_client(std::shared_ptr<connection> client, const message& msg)
       {
@@ -124,6 +261,7 @@ namespace rm_net
         {
           upon_disconnection(client);
           client.reset();
+          std::scoped_lock lock(connections_mtx);
           my_connections.erase(
             std::remove(my_connections.begin(), my_connections.end(), client),
                         my_connections.end());
@@ -148,27 +286,185 @@ namespace rm_net
         }
         if (invalidClientExists)
         {
+          std::scoped_lock lock(connections_mtx);
           my_connections.erase(
             std::remove(my_connections.begin(), my_connections.end(), ignored_client),
                         my_connections.end());
         }
       }
 
+      // Messages of a registered session are decoded with the session's
+      // modulus on the io thread that read them, so the peers of a round are
+      // decoded in parallel; those of other sessions are decoded in update().
+      void register_session(uint32_t sid, const NTL::ZZ& prime)
+      {
+        std::shared_ptr<decode_session> session = std::make_shared<decode_session>(decode_session{prime, NTL::ZZ_pContext(prime)});
+        std::scoped_lock lock(sessions_mtx);
+        decode_sessions[sid] = std::move(session);
+      }
+
+      // also drops the session's receive buffers
+      void unregister_session(uint32_t sid)
+      {
+        buffers.remove_session(sid);
+        std::scoped_lock lock(sessions_mtx);
+        decode_sessions.erase(sid);
+      }
+
+      // where sessions register the destinations of the payloads they wait for
+      receive_buffers& round_buffers()
+      {
+        return buffers;
+      }
+
       void update(const rm_info& info, 
                   rm_net::async_queue<rm_net::deserialized_message>& deserialized_msgs, 
                   size_t max_messages = -1) // -1 is the max number
       {
         size_t message_count = 0;
+        accept_shm_parties();
+        {
+          // in-memory transports deliver on this thread
+          std::scoped_lock lock(connections_mtx);
+          for (auto& conn : my_connections)
+          {
+            if (conn)
+              conn->poll();
+          }
+        }
+        received_depth.set(my_received_messages.count());
         while (message_count < max_messages && !my_received_messages.is_empty())
         {
           auto rec_msg = my_received_messages.pop_front();
+          record_dequeue_age(rec_msg.msg.header);
           // sanitization: to be removed
           prepare_message(deserialized_msgs, rec_msg, info);
+          decoded_in_update.inc();
+          message_count ++;
+        }
+        // messages decoded on receive; taken after the queue above, which only
+        // holds a registered session's messages from before its registration
+        while (message_count < max_messages && !my_decoded_messages.is_empty())
+        {
+          deserialized_msgs.push_back(my_decoded_messages.pop_front());
           message_count ++;
         }
       }
 
+      // counters of every accepted connection
+      std::vector<connection_stats> stats()
+      {
+        std::vector<connection_stats> out;
+        std::scoped_lock lock(connections_mtx);
+        for (auto& conn : my_connections)
+        {
+          if (conn)
+            out.push_back(conn->stats());
+        }
+        return out;
+      }
+
     protected:
+      struct decode_session
+      {
+        NTL::ZZ prime;
+        NTL::ZZ_pContext context;
+      };
+
+      connection::receive_hook decode_hook()
+      {
+        return [this](const std::shared_ptr<connection>& conn, message& msg) { return decode_on_receive(conn, msg); };
+      }
+
+      // runs on an io thread; false leaves msg to update()
+      bool decode_on_receive(const std::shared_ptr<connection>& conn, message& msg)
+      {
+        std::shared_ptr<decode_session> session;
+        {
+          std::scoped_lock lock(sessions_mtx);
+          auto it = decode_sessions.find(msg.header.sid);
+          if (it == decode_sessions.end())
+          {
+            return false;
+          }
+          session = it->second;
+        }
+        session->context.restore(); // the ZZ_p modulus is per thread
+        deserialized_message temp;
+        decode_message(temp, conn, msg, session->prime);
+        my_decoded_messages.push_back(std::move(temp));
+        decoded_on_receive.inc();
+        return true;
+      }
+
+      // fill dm from msg; client submissions stay in wire format and are decoded by
+      // the share matrix, and payloads with a registered buffer are decoded into it
+      void decode_message(deserialized_message& dm, const std::shared_ptr<connection>& conn, message& msg, const NTL::ZZ& prime)
+      {
+        dm.sid = msg.header.sid;
+        dm.tot_num_blocks = msg.header.tot_num_blocks;
+        dm.block_idx = msg.header.block_idx;
+        dm.mixing_state_id = msg.header.mixing_state_id;
+        dm.sender_id = msg.header.sender_id;
+        dm.conn = conn;
+        if (dm.mixing_state_id == 0)
+        {
+          dm.num_ZZ_p = msg.header.num_ZZ_p;
+          dm.raw = std::move(msg.body);
+          return;
+        }
+        std::vector<NTL::ZZ_p*> elems;
+        if (buffers.take(msg.header, elems))
+        {
+          size_t nbytes = NTL::NumBytes(prime);
+          size_t count = msg.header.num_ZZ_p;
+          if (elems.size() == count && msg.body.size() == count * nbytes)
+          {
+            // the wire holds the last element first
+            for (size_t i = 0 ; i != count ; i++)
+            {
+              NTL::conv(*elems[i], NTL::ZZFromBytes(msg.body.data() + (count - 1 - i) * nbytes, nbytes));
+            }
+            dm.in_place = true;
+            return;
+          }
+        }
+        dm.body.SetLength(1);
+        deserialize_to_vec_ZZ_p(dm.body[0], msg, prime);
+        assert(dm.body[0].length() == msg.header.num_ZZ_p);
+      }
+
+      // accept the parties that attached to the shared-memory segment since the last call
+      void accept_shm_parties()
+      {
+        if (!shm_listener)
+        {
+          return;
+        }
+        for (uint32_t i = 0 ; i != shm_listener->num_slots() ; i++)
+        {
+          if (shm_listener->accept(i))
+          {
+            RM_LOG_INFO("Accepted shared memory connection from party " << i);
+            accept_transport(std::make_unique<shm_transport>(shm_listener, i, true));
+          }
+        }
+      }
+
+      // time from the sender's header stamp until update() takes the message, per state
+      void record_dequeue_age(const message_header& header)
+      {
+        size_t state = std::min<size_t>(header.mixing_state_id, dequeue_age.size() - 1);
+        if (dequeue_age[state] == nullptr)
+        {
+          dequeue_age[state] = &rm_metrics().histogram("rm_dequeue_age_ms",
+                                                       "Time from a message's send stamp until the server loop takes it",
+                                                       "state=\"" + std::to_string(state) + "\"");
+        }
+        auto lapsed = std::chrono::system_clock::now() - header.time;
+        dequeue_age[state]->observe(std::chrono::duration<double, std::milli>(lapsed).count());
+      }
+
       // called when a client connects (false = rejection of connection)
       virtual bool upon_connection(std::shared_ptr<connection> client)
       {
@@ -178,7 +474,7 @@ namespace rm_net
       // called when a client disconnects
       virtual void upon_disconnection(std::shared_ptr<connection> client)
       {
-        std::cout << "Client[" << client->GetID() << "] disconnected\n";
+        RM_LOG_INFO("Client[" << client->GetID() << "] disconnected");
       }
 
       // called when a message is received.
@@ -189,33 +485,47 @@ namespace rm_net
         const rm_info& info)
       {
         deserialized_message temp;
-        temp.sid = rec_msg.msg.header.sid;
-        temp.tot_num_blocks = rec_msg.msg.header.tot_num_blocks;
-        temp.block_idx = rec_msg.msg.header.block_idx;
-        temp.mixing_state_id = rec_msg.msg.header.mixing_state_id;
-        temp.sender_id = rec_msg.msg.header.sender_id;
-        temp.conn = rec_msg.conn;
-        temp.body.SetLength(1);
-        deserialize_to_vec_ZZ_p(temp.body[0], rec_msg.msg, info.fft_prime_info.prime);
-        assert(temp.body[0].length() == rec_msg.msg.header.num_ZZ_p);
+        decode_message(temp, rec_msg.conn, rec_msg.msg, info.fft_prime_info.prime);
         deserialized_msgs.push_back(std::move(temp));
       }
 
     protected:
 
-      // asio
-      boost::asio::io_context my_context;
-      std::thread my_thread;
+      // asio - the threads running every accepted connection
+      io_pool& my_pool;
+      boost::asio::io_context& my_context;
 
       // ts queue for received messages
       async_queue<received_message> my_received_messages;
       std::deque<std::shared_ptr<connection>> my_connections;
+      std::mutex connections_mtx; // guards my_connections against stats()
+
+      bool pool_started = false;
+      std::atomic<bool> stopped{false};
+      std::mutex accept_mtx; // orders re-arming an acceptor against closing it in stop()
+      std::atomic<size_t> pending_accepts{0}; // accept handlers not yet finished
 
       // acceptor
       boost::asio::ip::tcp::acceptor my_acceptor;
 
+      // local endpoints set up by listen_local()
+      std::optional<boost::asio::local::stream_protocol::acceptor> local_acceptor;
+      std::shared_ptr<shm_segment> shm_listener;
+
+      receive_buffers buffers;
+
+      // sessions decoded on receive, and the messages decoded so far
+      std::map<uint32_t, std::shared_ptr<decode_session>> decode_sessions;
+      std::mutex sessions_mtx;
+      async_queue<deserialized_message> my_decoded_messages;
+      metric_counter& decoded_on_receive = rm_metrics().counter("rm_decoded_total", "Received messages decoded", "where=\"receive\"");
+      metric_counter& decoded_in_update = rm_metrics().counter("rm_decoded_total", "Received messages decoded", "where=\"update\"");
+
       // other servers will be identified via an ID
       uint32_t id_counter = 10000;
 
+      std::vector<metric_histogram*> dequeue_age = std::vector<metric_histogram*>(64, nullptr);
+      metric_gauge& received_depth = rm_metrics().gauge("rm_queue_depth", "Messages waiting in a queue", "queue=\"received\"");
+
   };
 }
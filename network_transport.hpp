@@ -0,0 +1,648 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+
+#include "network_common.hpp"
+#include "network_ts_queue.hpp"
+#include "network_message.hpp"
+#include "network_io_pool.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <functional>
+
+namespace rm_net
+{
+  // Moves whole messages between two parties. A connection owns one transport
+  // and keeps the queueing, ordering and accounting above it.
+  class transport
+  {
+    public:
+      using receive_handler = std::function<void(message&)>;
+      using error_handler = std::function<void(const char*)>;
+      using write_handler = std::function<void(std::error_code, std::size_t)>;
+
+      virtual ~transport() {}
+
+      // called once by the owning connection before any other call; every
+      // handler of the transport must run on the connection's strand
+      virtual void attach(const conn_executor& conn_strand) { strand = &conn_strand; }
+
+      // deliver every received message to on_message, which may move from it;
+      // on_error runs once if the transport fails
+      virtual void start_reading(receive_handler on_message, error_handler on_error) = 0;
+
+      // send msg and run done(ec, bytes) on the connection's strand once msg
+      // is no longer needed; msg may be moved from
+      virtual void write(message& msg, write_handler done) = 0;
+
+      virtual bool is_open() const = 0;
+
+      virtual void close() = 0;
+
+      // deliver messages that are waiting in memory from the caller's thread;
+      // socket transports are driven by asio and deliver nothing here
+      virtual size_t poll() { return 0; }
+
+    protected:
+      const conn_executor* strand = nullptr;
+  };
+
+  // The header + body framing over any asio stream socket.
+  template<typename Socket> class stream_transport : public transport
+  {
+    public:
+      explicit stream_transport(Socket s) : socket(std::move(s)) {}
+
+      Socket& get_socket() { return socket; }
+
+      void start_reading(receive_handler on_message, error_handler on_error) override
+      {
+        deliver = std::move(on_message);
+        fail = std::move(on_error);
+        read_header();
+      }
+
+      void write(message& msg, write_handler done) override
+      {
+        boost::asio::async_write(
+          socket,
+          boost::asio::buffer(&msg.header, sizeof(message_header)),
+          boost::asio::bind_executor(*strand, [this, &msg, done](std::error_code ec, std::size_t length)
+          {
+            if (ec || msg.header.size == 0)
+            {
+              done(ec, length);
+              return;
+            }
+            boost::asio::async_write(
+              socket,
+              boost::asio::buffer(msg.body.data(), msg.header.size),
+              boost::asio::bind_executor(*strand, [length, done](std::error_code ec, std::size_t body_length)
+              {
+                done(ec, length + body_length);
+              }));
+          }));
+      }
+
+      bool is_open() const override
+      {
+        return socket.is_open();
+      }
+
+      void close() override
+      {
+        boost::system::error_code ec;
+        socket.close(ec);
+      }
+
+    private:
+      // asio - read a message header
+      void read_header()
+      {
+        boost::asio::async_read(
+              socket,
+              boost::asio::buffer(&temp_msg.header, sizeof(message_header)),
+        boost::asio::bind_executor(*strand, [this](std::error_code ec, std::size_t)
+        {
+          if(!ec)
+          {
+            if (temp_msg.header.size > 0)
+            {
+              temp_msg.body.resize(temp_msg.header.size);
+              read_body();
+            }
+            else
+            {
+              deliver(temp_msg);
+              read_header();
+            }
+          }
+          else
+          {
+            fail("Reading header failed.");
+          }
+        }));
+      }
+
+      // asio - read a message body
+      void read_body()
+      {
+        boost::asio::async_read(
+              socket,
+              boost::asio::buffer(temp_msg.body.data(),temp_msg.header.size),
+        boost::asio::bind_executor(*strand, [this](std::error_code ec, std::size_t)
+        {
+          if (!ec)
+          {
+            deliver(temp_msg);
+            read_header();
+          }
+          else
+          {
+            fail("Reading body failed.");
+          }
+        }));
+      }
+
+      Socket socket;
+      message temp_msg; // the message being read
+      receive_handler deliver;
+      error_handler fail;
+  };
+
+  // one direction of an in-memory link
+  struct memory_pipe
+  {
+    spsc_ring<message> ring{4096};
+    std::atomic<bool> open{true};
+  };
+
+  // Hands messages to a peer in the same process through a pair of SPSC
+  // rings. The writer's strand is the only producer of its outgoing ring and
+  // the thread that calls poll() is the only consumer of the incoming one, so
+  // a message body moves from sender to receiver without being copied.
+  class memory_transport : public transport
+  {
+    public:
+      memory_transport(std::shared_ptr<memory_pipe> in, std::shared_ptr<memory_pipe> out)
+      : incoming(std::move(in)), outgoing(std::move(out))
+      {
+      }
+
+      void start_reading(receive_handler on_message, error_handler on_error) override
+      {
+        deliver = std::move(on_message);
+        fail = std::move(on_error);
+        reading = true;
+      }
+
+      void write(message& msg, write_handler done) override
+      {
+        if (!outgoing->open.load())
+        {
+          boost::asio::post(*strand, [done]() { done(std::make_error_code(std::errc::broken_pipe), 0); });
+          return;
+        }
+        std::size_t length = sizeof(message_header) + msg.body.size();
+        if (outgoing->ring.try_push(msg))
+        {
+          boost::asio::post(*strand, [done, length]() { done(std::error_code(), length); });
+        }
+        else
+        {
+          // the peer is behind; retry once the strand has run other work
+          boost::asio::post(*strand, [this, &msg, done]() { write(msg, done); });
+        }
+      }
+
+      bool is_open() const override
+      {
+        return outgoing->open.load() && incoming->open.load();
+      }
+
+      void close() override
+      {
+        outgoing->open.store(false);
+        incoming->open.store(false);
+      }
+
+      size_t poll() override
+      {
+        if (!reading.load())
+        {
+          return 0;
+        }
+        size_t delivered = 0;
+        message msg;
+        while (incoming->ring.try_pop(msg))
+        {
+          deliver(msg);
+          delivered++;
+        }
+        return delivered;
+      }
+
+    private:
+      std::shared_ptr<memory_pipe> incoming;
+      std::shared_ptr<memory_pipe> outgoing;
+      std::atomic<bool> reading{false};
+      receive_handler deliver;
+      error_handler fail;
+  };
+
+  // two ends of an in-memory link
+  std::pair<std::unique_ptr<transport>, std::unique_ptr<transport>> make_memory_link()
+  {
+    auto a_to_b = std::make_shared<memory_pipe>();
+    auto b_to_a = std::make_shared<memory_pipe>();
+    return {std::make_unique<memory_transport>(b_to_a, a_to_b),
+            std::make_unique<memory_transport>(a_to_b, b_to_a)};
+  }
+
+  // Control words of one direction of a shared-memory byte ring. Positions
+  // only grow; the ring index is position % ring size.
+  struct shm_ring_ctl
+  {
+    alignas(64) std::atomic<uint64_t> head; // reader position
+    alignas(64) std::atomic<uint64_t> tail; // writer position
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared-memory rings need lock-free 64-bit atomics");
+
+  // one party's pair of rings in a server's segment
+  struct shm_slot_ctl
+  {
+    // free_slot -> claimed (by the connecting party) -> connecting -> accepted (by the
+    // server) -> closed by either end, and free again once both ends are gone
+    enum : uint32_t { free_slot = 0, connecting = 1, accepted = 2, closed = 3, claimed = 4 };
+    alignas(64) std::atomic<uint32_t> state;
+    std::atomic<uint32_t> holders; // ends of the link still attached
+    shm_ring_ctl to_server;
+    shm_ring_ctl to_party;
+  };
+
+  // single-producer single-consumer byte ring in shared memory
+  class shm_byte_ring
+  {
+    public:
+      shm_byte_ring(shm_ring_ctl* c, unsigned char* d, uint64_t bytes) : ctl(c), data(d), size(bytes) {}
+
+      // copy up to n bytes in; returns how many fit
+      size_t write(const unsigned char* p, size_t n)
+      {
+        uint64_t t = ctl->tail.load(std::memory_order_relaxed);
+        uint64_t h = ctl->head.load(std::memory_order_acquire);
+        size_t k = std::min<uint64_t>(n, size - (t - h));
+        size_t first = std::min<uint64_t>(k, size - t % size);
+        std::memcpy(data + t % size, p, first);
+        std::memcpy(data, p + first, k - first);
+        ctl->tail.store(t + k, std::memory_order_release);
+        return k;
+      }
+
+      // copy up to n bytes out; returns how many were available
+      size_t read(unsigned char* p, size_t n)
+      {
+        uint64_t h = ctl->head.load(std::memory_order_relaxed);
+        uint64_t t = ctl->tail.load(std::memory_order_acquire);
+        size_t k = std::min<uint64_t>(n, t - h);
+        size_t first = std::min<uint64_t>(k, size - h % size);
+        std::memcpy(p, data + h % size, first);
+        std::memcpy(p + first, data, k - first);
+        ctl->head.store(h + k, std::memory_order_release);
+        return k;
+      }
+
+      void reset()
+      {
+        ctl->head.store(0);
+        ctl->tail.store(0);
+      }
+
+    private:
+      shm_ring_ctl* ctl;
+      unsigned char* data;
+      uint64_t size;
+  };
+
+  // A POSIX shared-memory segment created by a listening server. Slots 1..n
+  // belong to the servers of those ids; slot 0 and the slots after the last
+  // server id are taken by clients on a first-come basis. Each slot holds a
+  // ring per direction.
+  class shm_segment
+  {
+    public:
+      static const uint64_t default_ring_bytes = 1 << 20;
+
+      ~shm_segment()
+      {
+        if (base != nullptr)
+          munmap(base, length);
+        if (owner)
+          shm_unlink(name.c_str());
+      }
+
+      // create (replacing a stale one) the segment of a listening server
+      static std::shared_ptr<shm_segment> create(const std::string& shm_name, uint32_t party_slots, uint32_t client_slots, uint64_t ring_bytes = default_ring_bytes)
+      {
+        uint32_t slots = party_slots + client_slots;
+        std::shared_ptr<shm_segment> seg(new shm_segment("/rm_" + shm_name));
+        shm_unlink(seg->name.c_str());
+        int fd = shm_open(seg->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+          return nullptr;
+        seg->length = sizeof(segment_header) + slots * slot_bytes(ring_bytes);
+        if (ftruncate(fd, seg->length) != 0 || !seg->map(fd))
+        {
+          close(fd);
+          return nullptr;
+        }
+        close(fd);
+        seg->owner = true;
+        segment_header* h = new (seg->base) segment_header;
+        h->num_slots = slots;
+        h->party_slots = party_slots;
+        h->ring_bytes = ring_bytes;
+        for (uint32_t i = 0 ; i != slots ; i++)
+        {
+          shm_slot_ctl* c = new (seg->slot(i)) shm_slot_ctl;
+          c->state.store(shm_slot_ctl::free_slot);
+          c->holders.store(0);
+          seg->ring(i, true).reset();
+          seg->ring(i, false).reset();
+        }
+        return seg;
+      }
+
+      // map the segment of a server on this host
+      static std::shared_ptr<shm_segment> attach(const std::string& shm_name)
+      {
+        std::shared_ptr<shm_segment> seg(new shm_segment("/rm_" + shm_name));
+        int fd = shm_open(seg->name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+          return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(segment_header)))
+        {
+          close(fd);
+          return nullptr;
+        }
+        seg->length = st.st_size;
+        bool mapped = seg->map(fd);
+        close(fd);
+        return mapped ? seg : nullptr;
+      }
+
+      uint32_t num_slots() const { return header()->num_slots; }
+
+      // slot 0 and the slots from here on are for clients
+      uint32_t party_slots() const { return header()->party_slots; }
+
+      // take slot i for a connecting party if it is free; only its new owner touches the rings
+      bool claim(uint32_t i)
+      {
+        uint32_t expected = shm_slot_ctl::free_slot;
+        if (i >= num_slots() || !slot(i)->state.compare_exchange_strong(expected, shm_slot_ctl::claimed))
+        {
+          return false;
+        }
+        slot(i)->holders.fetch_add(1);
+        ring(i, true).reset();
+        ring(i, false).reset();
+        slot(i)->state.store(shm_slot_ctl::connecting); // the server accepts from here on
+        return true;
+      }
+
+      // take the server's end of slot i if a party is waiting on it
+      bool accept(uint32_t i)
+      {
+        shm_slot_ctl* c = slot(i);
+        if (c->state.load() != shm_slot_ctl::connecting)
+        {
+          return false;
+        }
+        c->holders.fetch_add(1);
+        uint32_t expected = shm_slot_ctl::connecting;
+        if (!c->state.compare_exchange_strong(expected, shm_slot_ctl::accepted))
+        {
+          release(i);
+          return false;
+        }
+        return true;
+      }
+
+      // drop one end of slot i; the last end out frees the slot
+      void release(uint32_t i)
+      {
+        shm_slot_ctl* c = slot(i);
+        if (c->holders.fetch_sub(1) == 1)
+        {
+          uint32_t expected = shm_slot_ctl::closed;
+          c->state.compare_exchange_strong(expected, shm_slot_ctl::free_slot);
+        }
+      }
+
+      shm_slot_ctl* slot(uint32_t i)
+      {
+        return reinterpret_cast<shm_slot_ctl*>(static_cast<unsigned char*>(base) + sizeof(segment_header)
+                                               + i * slot_bytes(header()->ring_bytes));
+      }
+
+      // the ring towards the server (to_server) or towards the party of slot i
+      shm_byte_ring ring(uint32_t i, bool to_server)
+      {
+        shm_slot_ctl* c = slot(i);
+        unsigned char* data = reinterpret_cast<unsigned char*>(c) + sizeof(shm_slot_ctl);
+        uint64_t bytes = header()->ring_bytes;
+        if (!to_server)
+          data += bytes;
+        return shm_byte_ring(to_server ? &c->to_server : &c->to_party, data, bytes);
+      }
+
+    private:
+      struct alignas(64) segment_header
+      {
+        uint32_t num_slots;
+        uint32_t party_slots;
+        uint64_t ring_bytes;
+      };
+
+      explicit shm_segment(const std::string& n) : name(n) {}
+
+      static uint64_t slot_bytes(uint64_t ring_bytes)
+      {
+        return sizeof(shm_slot_ctl) + 2 * ring_bytes;
+      }
+
+      bool map(int fd)
+      {
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+          return false;
+        base = p;
+        return true;
+      }
+
+      const segment_header* header() const { return static_cast<const segment_header*>(base); }
+
+      std::string name;
+      void* base = nullptr;
+      size_t length = 0;
+      bool owner = false;
+  };
+
+  // Frames messages over one slot of a shm_segment. Writes that do not fit
+  // are finished from the connection's strand as the reader drains the
+  // ring; received bytes are assembled into messages by poll().
+  class shm_transport : public transport
+  {
+    public:
+      // takes over the end of slot_idx claimed or accepted on seg
+      shm_transport(std::shared_ptr<shm_segment> seg, uint32_t slot_idx, bool server_side)
+      : segment(std::move(seg)),
+        slot(slot_idx),
+        in(segment->ring(slot_idx, server_side)),
+        out(segment->ring(slot_idx, !server_side))
+      {
+      }
+
+      ~shm_transport()
+      {
+        close();
+        segment->release(slot);
+      }
+
+      void start_reading(receive_handler on_message, error_handler on_error) override
+      {
+        deliver = std::move(on_message);
+        fail = std::move(on_error);
+        reading = true;
+      }
+
+      void write(message& msg, write_handler done) override
+      {
+        write_from(msg, 0, done);
+      }
+
+      bool is_open() const override
+      {
+        uint32_t state = segment->slot(slot)->state.load();
+        return state == shm_slot_ctl::connecting || state == shm_slot_ctl::accepted;
+      }
+
+      void close() override
+      {
+        segment->slot(slot)->state.store(shm_slot_ctl::closed);
+      }
+
+      size_t poll() override
+      {
+        if (!reading.load())
+        {
+          return 0;
+        }
+        size_t delivered = 0;
+        while (true)
+        {
+          if (got < sizeof(message_header))
+          {
+            got += in.read(reinterpret_cast<unsigned char*>(&temp_msg.header) + got, sizeof(message_header) - got);
+            if (got < sizeof(message_header))
+              break;
+            temp_msg.body.resize(temp_msg.header.size);
+          }
+          size_t body_got = got - sizeof(message_header);
+          got += in.read(temp_msg.body.data() + body_got, temp_msg.header.size - body_got);
+          if (got < sizeof(message_header) + temp_msg.header.size)
+            break;
+          deliver(temp_msg);
+          got = 0;
+          delivered++;
+        }
+        // everything the peer wrote before closing has been delivered by now
+        if (!failed && segment->slot(slot)->state.load() == shm_slot_ctl::closed)
+        {
+          failed = true;
+          fail("Shared memory peer closed.");
+        }
+        return delivered;
+      }
+
+    private:
+      // write msg from byte offset on, retrying shortly while the ring is full
+      void write_from(message& msg, size_t offset, write_handler done)
+      {
+        if (!is_open())
+        {
+          boost::asio::post(*strand, [done]() { done(std::make_error_code(std::errc::broken_pipe), 0); });
+          return;
+        }
+        const size_t header_bytes = sizeof(message_header);
+        size_t total = header_bytes + msg.header.size;
+        if (offset < header_bytes)
+        {
+          offset += out.write(reinterpret_cast<const unsigned char*>(&msg.header) + offset, header_bytes - offset);
+        }
+        if (offset >= header_bytes && offset < total)
+        {
+          offset += out.write(msg.body.data() + offset - header_bytes, total - offset);
+        }
+        if (offset == total)
+        {
+          boost::asio::post(*strand, [done, total]() { done(std::error_code(), total); });
+          return;
+        }
+        auto timer = std::make_shared<boost::asio::steady_timer>(*strand, std::chrono::microseconds(50));
+        timer->async_wait([this, timer, &msg, offset, done](const boost::system::error_code&) { write_from(msg, offset, done); });
+      }
+
+      std::shared_ptr<shm_segment> segment;
+      uint32_t slot;
+      shm_byte_ring in;
+      shm_byte_ring out;
+      std::atomic<bool> reading{false};
+      message temp_msg; // the message being assembled by poll()
+      size_t got = 0;   // bytes of temp_msg received so far
+      receive_handler deliver;
+      error_handler fail;
+      bool failed = false; // fail has been called
+  };
+
+  // Connect to the listening server of a segment as server party_id, or as a
+  // client when party_id is 0, in which case any free client slot is claimed.
+  // Returns nullptr if the slot is taken or no client slot is free.
+  std::unique_ptr<transport> shm_connect(const std::string& shm_name, uint32_t party_id)
+  {
+    std::shared_ptr<shm_segment> seg = shm_segment::attach(shm_name);
+    if (!seg)
+    {
+      return nullptr;
+    }
+    if (party_id != 0)
+    {
+      if (party_id >= seg->party_slots() || !seg->claim(party_id))
+      {
+        return nullptr;
+      }
+      return std::make_unique<shm_transport>(seg, party_id, false);
+    }
+    for (uint32_t i = 0 ; i != seg->num_slots() ; i = (i == 0 ? seg->party_slots() : i+1))
+    {
+      if (seg->claim(i))
+      {
+        return std::make_unique<shm_transport>(seg, i, false);
+      }
+    }
+    return nullptr;
+  }
+}
@@ -56,6 +56,13 @@ namespace rm_net
         deqQueue.emplace_back(std::move(item));
       }
 
+      // move a message to the back of the queue
+      void push_back(T&& item)
+      {
+        std::scoped_lock lock(mtxQueue);
+        deqQueue.emplace_back(std::move(item));
+      }
+
       // returns 1 if and only if the queue is empty
       bool is_empty()
       {
@@ -90,4 +97,58 @@ namespace rm_net
       std::mutex mtxQueue;
       std::deque<T> deqQueue;
   };
+
+  // A bounded lock-free queue for exactly one producer thread and one
+  // consumer thread. Items are moved in and out, never copied.
+  template<typename T> class spsc_ring
+  {
+    public:
+      // capacity is rounded up to a power of two
+      explicit spsc_ring(size_t capacity = 1024)
+      {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        slots.resize(cap);
+        mask = cap - 1;
+      }
+
+      spsc_ring(const spsc_ring&) = delete;
+
+      // move item in if there is room; item is left untouched otherwise
+      bool try_push(T& item)
+      {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+          return false;
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+      }
+
+      // move the oldest item out, if any
+      bool try_pop(T& out)
+      {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+          return false;
+        }
+        out = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+      }
+
+      size_t count() const
+      {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+      }
+
+    protected:
+      std::vector<T> slots;
+      size_t mask = 0;
+      alignas(64) std::atomic<size_t> head{0}; // consumer position
+      alignas(64) std::atomic<size_t> tail{0}; // producer position
+  };
 }
\ No newline at end of file
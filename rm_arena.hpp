@@ -0,0 +1,140 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <sys/mman.h>
+#include <assert.h>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "rm_log.hpp"
+#include "rm_metrics.hpp"
+
+// Bump allocator over 2 MB huge pages for the contiguous storage of one
+// session. Blocks are never freed one by one: release() returns every chunk
+// at once. Chunks come from the reserved huge page pool (MAP_HUGETLB) when
+// it has room, and are otherwise ordinary mappings marked for transparent
+// huge pages. Fresh mappings are zero-filled, so every block starts zeroed.
+// The first chunk is sized to the first block; later ones double up to the
+// chunk size, so a small session holds only what it uses.
+class session_arena
+{
+  public:
+    static const size_t huge_page = size_t(2) << 20;
+    static const size_t alignment = 64;
+
+    explicit session_arena(size_t chunk = 32 * huge_page) : chunk_bytes(chunk) {} // largest chunk mapped ahead of need
+    session_arena(const session_arena&) = delete;
+    session_arena& operator=(const session_arena&) = delete;
+    ~session_arena() { release(); }
+
+    // a zeroed block of bytes aligned to a cache line; nullptr if out of memory
+    void* allocate(size_t bytes)
+    {
+      bytes = (bytes + alignment - 1) / alignment * alignment;
+      std::scoped_lock lock(mtx);
+      if (chunks.empty() || chunks.back().size - chunks.back().used < bytes)
+      {
+        size_t next = chunks.empty() ? 0 : std::min(chunk_bytes, 2 * chunks.back().size);
+        if (!add_chunk(std::max(next, bytes)))
+        {
+          return nullptr;
+        }
+      }
+      chunk& c = chunks.back();
+      void* block = c.base + c.used;
+      c.used += bytes;
+      return block;
+    }
+
+    // unmap every chunk; blocks handed out before must no longer be used
+    void release()
+    {
+      std::scoped_lock lock(mtx);
+      for (auto& c : chunks)
+      {
+        ::munmap(c.base, c.size);
+        live_gauge().add(-static_cast<int64_t>(c.size));
+      }
+      chunks.clear();
+    }
+
+    // bytes mapped by the arena
+    size_t reserved()
+    {
+      std::scoped_lock lock(mtx);
+      size_t total = 0;
+      for (auto& c : chunks)
+      {
+        total += c.size;
+      }
+      return total;
+    }
+
+  private:
+    struct chunk
+    {
+      unsigned char* base;
+      size_t size;
+      size_t used;
+    };
+
+    bool add_chunk(size_t bytes)
+    {
+      size_t size = (bytes + huge_page - 1) / huge_page * huge_page;
+      void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      const char* backing = "hugetlb";
+      if (addr == MAP_FAILED)
+      {
+        addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+          RM_LOG_ERROR("Session arena could not map " << size << " bytes");
+          return false;
+        }
+        ::madvise(addr, size, MADV_HUGEPAGE);
+        backing = "thp";
+      }
+      chunks.push_back({static_cast<unsigned char*>(addr), size, 0});
+      rm_metrics().counter("rm_arena_bytes_total", "Bytes mapped by session arenas", std::string("backing=\"") + backing + "\"").inc(size);
+      live_gauge().add(size);
+      return true;
+    }
+
+    static metric_gauge& live_gauge()
+    {
+      static metric_gauge& g = rm_metrics().gauge("rm_live_bytes", "Bytes of session data currently allocated", "kind=\"arena\"");
+      return g;
+    }
+
+    size_t chunk_bytes;
+    std::vector<chunk> chunks;
+    std::mutex mtx;
+};
@@ -0,0 +1,304 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+/* RM Tool Libraries */
+#include "rm_common.hpp"
+#include "secretsharing.h"
+#include "additive2basis.h"
+#include "root_finding.h"
+#include "rm_share_matrix.hpp"
+#include "rm_rns.hpp"
+
+/* MPC Networking Libraries */
+#include "network_common.hpp"
+#include "network_message.hpp"
+
+/* Standard Libraries */
+#include <assert.h>
+#include <functional>
+#include <sstream>
+#include <string>
+
+/* NTL Libraries */
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vector.h>
+#include <NTL/vec_ZZ_p.h>
+
+// parse a comma-separated list of integers such as "256,384"
+std::vector<int> parse_int_list(const std::string& arg)
+{
+  std::vector<int> values;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    values.push_back(std::stoi(item));
+  }
+  return values;
+}
+
+// run fn once to warm up, then reps times, and print one result line
+void run_bench(const std::string& name,
+               const rm_info& info,
+               size_t reps,
+               const std::function<void()>& fn)
+{
+  double total = 0;
+  double best = 0;
+  fn();
+  for (size_t r = 0 ; r != reps ; r++)
+  {
+    auto start_tick = chrono::steady_clock::now();
+    fn();
+    auto end_tick = chrono::steady_clock::now();
+    double lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
+    total += lapsed;
+    if (r == 0 || lapsed < best)
+    {
+      best = lapsed;
+    }
+  }
+  std::stringstream s;
+  s << "[BENCH] " << name
+    << " prime=" << NTL::NumBits(info.fft_prime_info.prime)
+    << " L=" << info.L
+    << " N=" << info.N
+    << " reps=" << reps
+    << " mean_ms=" << total/reps
+    << " min_ms=" << best << "\n";
+  std::cout << s.str();
+}
+
+void bench_case(const rm_info& info, size_t reps, size_t bench_clients)
+{
+  size_t encoding_length = 7*info.L+5;
+  NTL::vec_ZZ_p xvals = gen_xvals(info.n);
+  NTL::ZZ_pX g0 = NTL::BuildFromRoots(xvals);
+
+  NTL::ZZ_p msg = NTL::random_ZZ_p();
+  NTL::vec_ZZ_p encoding;
+  add2basis_encode(&encoding, msg, info.L);
+  assert(static_cast<size_t>(encoding.length()) == encoding_length);
+
+  run_bench("add2basis_encode", info, reps, [&]() {
+    NTL::vec_ZZ_p code;
+    add2basis_encode(&code, msg, info.L);
+  });
+
+  run_bench("packed_share_secret", info, reps, [&]() {
+    for (size_t j = 0 ; j != encoding_length ; j++)
+    {
+      NTL::vec_ZZ_p secret;
+      secret.append(encoding[j]);
+      packed_share_secret(xvals, secret, info.t);
+    }
+  });
+
+  NTL::vec_ZZ_p coins;
+  NTL::random(coins, encoding_length-1);
+  run_bench("verify_format", info, reps, [&]() {
+    verify_format(coins, encoding, info.L);
+  });
+
+  run_bench("opt_decompress_encoding", info, reps, [&]() {
+    opt_decompress_encoding(encoding, info.L);
+  });
+
+  // shares of a random degree-2t value as they arrive in the first open round
+  NTL::vec_ZZ_p shares;
+  {
+    NTL::ZZ_pX poly;
+    for (size_t i = 0 ; i != 2*info.t+1 ; i++)
+    {
+      NTL::SetCoeff(poly, i, NTL::random_ZZ_p());
+    }
+    NTL::eval(shares, poly, xvals);
+  }
+  run_bench("rs_decode", info, reps, [&]() {
+    NTL::vec_ZZ_p secrets, errors;
+    rs_decode(secrets, errors, xvals, shares, g0, 2*info.t, 1);
+  });
+
+  // sums of powers over bench_clients decompressed inputs, native and RNS
+  size_t clients = std::min(bench_clients, info.N);
+  share_matrix inputs;
+  inputs.set_dims(clients, encoding_length, info.fft_prime_info.prime);
+  for (size_t i = 0 ; i != clients ; i++)
+  {
+    NTL::vec_ZZ_p code;
+    add2basis_encode(&code, NTL::random_ZZ_p(), info.L);
+    inputs.set_row(i, code);
+  }
+  run_bench("sums_of_powers_native", info, reps, [&]() {
+    share_matrix decompressed;
+    decompressed.set_dims(clients, info.N, info.fft_prime_info.prime);
+    NTL::vec_ZZ_p input_row;
+    for (size_t i = 0 ; i != clients ; i++)
+    {
+      inputs.get_row(input_row, i);
+      decompressed.set_row(i, opt_decompress_encoding(input_row, info.L));
+    }
+    NTL::vec_ZZ_p sums;
+    sums.SetLength(info.N);
+    for (size_t p = 0 ; p != info.N ; p++)
+    {
+      decompressed.column_sum(sums[p], p);
+    }
+  });
+  std::vector<std::pair<long,long>> pairs = decompress_encoding_pairs(info.L);
+  run_bench("sums_of_powers_rns", info, reps, [&]() {
+    rns_power_sums lanes;
+    lanes.init(info.fft_prime_info.prime, clients, encoding_length);
+    for (size_t i = 0 ; i != clients ; i++)
+    {
+      lanes.load_row(inputs, i);
+    }
+    NTL::vec_ZZ_p sums;
+    lanes.sums(sums, pairs, info.num_threads);
+  });
+
+  // a symmetric polynomial of degree N with N random roots and its power sums
+  NTL::vec_ZZ_p roots, power_sums;
+  NTL::random(roots, info.N);
+  power_sums.SetLength(info.N);
+  {
+    NTL::vec_ZZ_p powers = roots;
+    for (size_t p = 0 ; p != info.N ; p++)
+    {
+      for (size_t i = 0 ; i != info.N ; i++)
+      {
+        power_sums[p] += powers[i];
+        powers[i] *= roots[i];
+      }
+    }
+  }
+  NTL::ZZ_pX sym_poly;
+  run_bench("newton_to_polynomial", info, reps, [&]() {
+    newton_to_polynomial(sym_poly, power_sums, info.N);
+  });
+
+  run_bench("find_roots", info, reps, [&]() {
+    find_roots(sym_poly,
+               info.fft_prime_info.zeta,
+               info.fft_prime_info.two_exponent,
+               info.fft_prime_info.odd_factor);
+  });
+
+  NTL::ZZ_pX f, powers_of_w, powers_of_w_inv;
+  for (size_t i = 0 ; i != info.N ; i++)
+  {
+    NTL::SetCoeff(f, i, NTL::random_ZZ_p());
+    NTL::SetCoeff(powers_of_w, i, NTL::random_ZZ_p());
+    NTL::SetCoeff(powers_of_w_inv, i, NTL::random_ZZ_p());
+  }
+  run_bench("batch_eval", info, reps, [&]() {
+    batch_eval(f, powers_of_w, powers_of_w_inv);
+  });
+
+  run_bench("tangent_graeffe_transform", info, reps, [&]() {
+    NTL::ZZ rho = NTL::power2_ZZ(8);
+    tangent_graeffe_transform(sym_poly, rho, NTL::random_ZZ_p());
+  });
+
+  // a client submission through the wire format, both decode paths
+  rm_net::message wire;
+  wire.header.num_ZZ_p = 0;
+  serialize_from_vec_ZZ_p(wire, encoding, info.fft_prime_info.prime);
+  run_bench("serialize_from_vec_ZZ_p", info, reps, [&]() {
+    rm_net::message msg;
+    serialize_from_vec_ZZ_p(msg, encoding, info.fft_prime_info.prime);
+  });
+  run_bench("deserialize_to_vec_ZZ_p", info, reps, [&]() {
+    rm_net::message msg = wire;
+    NTL::vec_ZZ_p out;
+    deserialize_to_vec_ZZ_p(out, msg, info.fft_prime_info.prime);
+  });
+  run_bench("share_matrix_load_from_wire", info, reps, [&]() {
+    inputs.load_from_wire(0, wire.body.data(), encoding_length, NTL::NumBytes(info.fft_prime_info.prime));
+  });
+}
+
+int main(int argc, char *argv[]){
+  std::vector<int> primes = prime_length;
+  std::vector<int> Ls = L_value;
+  size_t reps = 5;
+  size_t bench_clients = 64;
+  rm_info info;
+  info.n = 5;
+  info.server_id = 1;
+  info.l = 1;
+  info.num_threads = 3;
+
+  for (int i = 1 ; i < argc ; i++)
+  {
+    std::string arg(argv[i]);
+    bool has_value = (i+1 < argc);
+    if (has_value && arg == "-p") primes = parse_int_list(argv[++i]);
+    else if (has_value && arg == "-L") Ls = parse_int_list(argv[++i]);
+    else if (has_value && arg == "-r") reps = std::stoul(argv[++i]);
+    else if (has_value && arg == "-n") info.n = std::stoul(argv[++i]);
+    else if (has_value && arg == "-c") bench_clients = std::stoul(argv[++i]);
+    else if (has_value && arg == "-j") info.num_threads = std::stoul(argv[++i]);
+    else
+    {
+      std::cout << "Usage: ./rm_bench [-p 256,384] [-L 5,9] [-r reps] [-n servers] [-c clients] [-j threads]" << std::endl;
+      return 1;
+    }
+  }
+  if (reps == 0)
+  {
+    std::cerr << "The number of repetitions must be positive" << std::endl;
+    return 1;
+  }
+  if(info.n%4 != 0){
+    info.t = info.n / 4;
+  }
+  else{
+    info.t = (info.n - 1) / 4;
+  }
+
+  for (size_t p = 0 ; p != primes.size() ; p++)
+  {
+    if(!fft_prime_from_bit_length(info.fft_prime_info, primes[p]))
+    {
+      std::cerr << "Prime Length is Invalid" << std::endl;
+      return 1;
+    }
+    NTL::ZZ_p::init(info.fft_prime_info.prime);
+    for (size_t l = 0 ; l != Ls.size() ; l++)
+    {
+      info.L = Ls[l];
+      info.N = 14 * pow(info.L, 2) + 10 * info.L - 1;
+      info.rns_mode = (primes[p] >= rns_min_prime_bits);
+      bench_case(info, reps, bench_clients);
+    }
+  }
+  return 0;
+}
@@ -30,6 +30,10 @@
 #include <NTL/ZZ.h>
 #include <NTL/ZZ_p.h>
 #include <NTL/vector.h>
+#include <NTL/vec_ZZ_p.h>
+#include <random>
+
+#include "secretsharing.h"
 
 /* MPC Networking Libraries */
 #include "network_common.hpp"
@@ -37,6 +41,7 @@
 #include "network_ts_queue.hpp"
 #include "network_connection.hpp"
 #include "network_client.hpp"
+#include "rm_output.hpp"
 
 class rm_client: public rm_net::client_interface
 {
@@ -51,7 +56,8 @@ class rm_client: public rm_net::client_interface
 
     std::chrono::system_clock::time_point time1;
 
-    void submit_message(
+    // the submission of one client's shares to a server; safe to build on any thread
+    static rm_net::message submission(
       const NTL::vec_ZZ_p& vec, 
       const rm_info& info, 
       const uint32_t& sid,
@@ -67,13 +73,85 @@ class rm_client: public rm_net::client_interface
       msg.header.num_ZZ_p = vec.length();
       serialize_from_vec_ZZ_p(msg, vec, info.fft_prime_info.prime);
       msg.header.time = std::chrono::system_clock::now();
+      return msg;
+    }
+
+    // set up a thread that encodes submissions: take the ZZ_p modulus of
+    // context and reseed NTL's generator, as sharing randomness must differ
+    // between threads
+    static void init_encoder_thread(const NTL::ZZ_pContext& context)
+    {
+      context.restore(); // the ZZ_p modulus is per thread
+      std::random_device rd;
+      unsigned char seed[32];
+      for (size_t k = 0 ; k != sizeof(seed) ; k++) seed[k] = static_cast<unsigned char>(rd());
+      NTL::SetSeed(seed, sizeof(seed));
+    }
+
+    // packed-share each element of a client's input encoding; shares[j] goes
+    // to server j
+    static void share_encoding(
+      NTL::vec_vec_ZZ_p& shares,
+      const NTL::vec_ZZ_p& msg_encoding,
+      const NTL::vec_ZZ_p& xvals,
+      const rm_info& info)
+    {
+      shares.SetLength(info.n);
+      for (long j = 0 ; j != msg_encoding.length() ; j++)
+      {
+        NTL::vec_ZZ_p secret; // sharing scheme takes as inputs a vector of secrets
+        secret.append(msg_encoding[j]);
+        NTL::vec_ZZ_p temp = packed_share_secret(xvals, secret, info.t);
+        for (size_t k = 0 ; k != info.n ; k++)
+        {
+          shares[k].append(temp[k]);
+        }
+      }
+    }
+
+    // send servers[j] its share as client my_id of session sid
+    static void submit_shares(
+      rm_client servers[],
+      const NTL::vec_vec_ZZ_p& shares,
+      const rm_info& info,
+      uint32_t sid,
+      size_t my_id)
+    {
+      for (size_t j = 0 ; j != info.n ; j++)
+      {
+        servers[j].send_message(submission(shares[j], info, sid, my_id));
+      }
+    }
+
+    void submit_message(
+      const NTL::vec_ZZ_p& vec, 
+      const rm_info& info, 
+      const uint32_t& sid,
+      const size_t& my_id)
+    {
+      rm_net::message msg = submission(vec, info, sid, my_id);
       time1 = msg.header.time;
       //std::cout << "**** Sending Message ****\n"; // Print out info
       //std::cout << msg; // Print out info
-      send_message(msg);
+      send_message(std::move(msg));
       //std::cout << "*** Sending Completed ***\n"; // Print out info
     }
 
+    // ask the server to stream the output of session in_sid once it is mixed
+    void subscribe_output(uint32_t in_sid)
+    {
+      rm_net::message msg;
+      msg.header.sid = in_sid;
+      msg.header.sender_id = local_partyID;
+      msg.header.mixing_state_id = output_subscribe_state;
+      msg.header.block_idx = 1;
+      msg.header.tot_num_blocks = 1;
+      msg.header.dimension = 1;
+      msg.header.num_ZZ_p = 0;
+      msg.header.size = 0;
+      send_message(std::move(msg));
+    }
+
     void send_vector(
       const NTL::vec_ZZ_p& vec,  // a vector of ZZ_p to be transmitted
       const rm_info& info,
@@ -95,7 +173,7 @@ class rm_client: public rm_net::client_interface
       serialize_from_vec_ZZ_p(msg, vec, info.fft_prime_info.prime);
       //std::cout << "**** Sending Message ****\n"; // Print out info
       //std::cout << msg; // Print out info
-      send_message(msg);
+      send_message(std::move(msg));
       //std::cout << "*** Sending Completed ***\n"; // Print out info
     }
 
@@ -36,10 +36,14 @@
 
 /* Standard Libraries */
 #include <assert.h>
+#include <atomic>
 #include <fstream>
 #include <ratio>
 #include <utility>
 #include <functional>
+#include <numeric>
+#include <random>
+#include <thread>
 
 /* NTL Libraries */
 #include <NTL/ZZ.h>
@@ -53,6 +57,9 @@
 #include "root_finding.h"
 #include "rm_common.hpp"
 #include "rm_client.hpp"
+#include "rm_memory_planner.hpp"
+#include "rm_sweep.hpp"
+#include "rm_metrics.hpp"
 
 int main(int argc, char *argv[]){
   // if true, the client is running in test mode, submitting messages of different configuration.
@@ -60,14 +67,40 @@ int main(int argc, char *argv[]){
   bool test_mode = true; 
   uint32_t sid = 0;
 
-  if(argc != 4){
-    std::cout << "Configuration Files Required as Follows:" << std::endl;
-    std::cout << "(1) mpc configuration" << std::endl;
-    std::cout << "(2) mix configuration" << std::endl;
-    std::cout << "(3) network configuration" << std::endl;
-    std::cout << "Usage: ./rm_server configs/mix_config configs/mpc_config configs/net_config" << std::endl;
+  std::multimap<std::string,std::string> options;
+  sweep_config sweep;
+  if(argc < 4 || !parse_options(argc, argv, 4, options) || !configure_sweep(sweep, options)){
+    RM_LOG_INFO("Configuration Files Required as Follows:");
+    RM_LOG_INFO("(1) mpc configuration");
+    RM_LOG_INFO("(2) mix configuration");
+    RM_LOG_INFO("(3) network configuration");
+    RM_LOG_INFO("Usage: ./rm_server configs/mix_config configs/mpc_config configs/net_config");
+    RM_LOG_INFO("       [--sweep file] [--case bits:L] [--warmup count] [--reps count] [--results prefix]");
+    RM_LOG_INFO("       [--metrics-file path] [--metrics-port port] [--log-level 0-4] [--io-threads count] [--send-budget bytes] [--fetch-output 0|1] [--connect-backoff ms:ms]");
+    RM_LOG_INFO("       [--encode-threads count]");
     return 1;
   }
+  if(options.count("log-level"))
+  {
+    rm_logger::instance().set_level(std::stoi(options.find("log-level")->second));
+  }
+  if(options.count("io-threads"))
+  {
+    rm_net::shared_io_pool().configure(std::stoul(options.find("io-threads")->second));
+  }
+  // bytes each outgoing connection may queue before sends block (0 = unbounded)
+  uint64_t send_budget = options.count("send-budget") ? std::stoull(options.find("send-budget")->second) : 0;
+  // retry schedule for connecting to peers
+  rm_net::connect_backoff backoff;
+  parse_connect_backoff(options, backoff.initial, backoff.max);
+  // subscribe to the output of every session and wait until t+1 servers agree on it
+  bool fetch_output = options.count("fetch-output") && std::stoi(options.find("fetch-output")->second) != 0;
+  // threads encoding and sharing messages
+  size_t encode_threads = std::max(1u, std::thread::hardware_concurrency());
+  if(options.count("encode-threads"))
+  {
+    encode_threads = std::max<size_t>(1, std::stoul(options.find("encode-threads")->second));
+  }
   std::string filename1(argv[1]);
   std::string filename2(argv[2]);
   std::string filename3(argv[3]);
@@ -79,7 +112,7 @@ int main(int argc, char *argv[]){
   fin3.open(filename3); // net config
 
   if(!fin1.is_open() || !fin2.is_open() || !fin3.is_open()){
-    std::cout << "Reading configuration file failed" << std::endl;
+    RM_LOG_WARN("Reading configuration file failed");
     return 1;
   }
 
@@ -89,7 +122,7 @@ int main(int argc, char *argv[]){
   /* Prime Modulus Setup */
   fin1 >> read_param; // reading prime length
   if(!fft_prime_from_bit_length(info.fft_prime_info, std::stoi(read_param))){
-    std::cerr << "Prime Length is Invalid" << std::endl;
+    RM_LOG_ERROR("Prime Length is Invalid");
     return 1;
   }
   NTL::ZZ_p::init(info.fft_prime_info.prime);
@@ -107,39 +140,45 @@ int main(int argc, char *argv[]){
   info.server_id = 0;
   info.l = 1; // packing param
 
-  std::cout << "prime: "  << info.fft_prime_info.prime << std::endl;
-  std::cout << "Number of Servers: "  << info.n << std::endl;
-  std::cout << "Max Number of Corrupted Servers: "  << info.t << std::endl;
-  std::cout << "Share Packing Size: "  << info.l << std::endl;
+  RM_LOG_INFO("prime: "  << info.fft_prime_info.prime);
+  RM_LOG_INFO("Number of Servers: "  << info.n);
+  RM_LOG_INFO("Max Number of Corrupted Servers: "  << info.t);
+  RM_LOG_INFO("Share Packing Size: "  << info.l);
 
   /* Mix Parameter Configuration */
   fin2 >> read_param;
   info.L = (size_t) std::stoi(read_param); 
   info.N = 14 * pow(info.L, 2)+ 10 * info.L - 1; // the number of messages to be mixed mixes
-  std::cout << "The number of messages in an epoch: "  << info.N << std::endl;
+  RM_LOG_INFO("The number of messages in an epoch: "  << info.N);
+  if(!read_mix_options(fin2, info.committees)){
+    return 1;
+  }
+  size_t num_servers = info.n * info.committees; // the servers of all committees, in net_config order
 
   /* Network Parameters */
   std::vector<std::string> IPs;
   std::vector<std::string> ports;
+  std::vector<std::string> locals; // unix: or shm: endpoints for co-located parties
   std::string temp_IP;
   std::string temp_port;
-  for(size_t i = 0 ; i != info.n ; i++){
+  for(size_t i = 0 ; i != num_servers ; i++){
     if (fin3.eof()){
-      cerr << "Incorrect Network Configuration" << endl;
+      RM_LOG_ERROR("Incorrect Network Configuration");
       return 1;
     }
     fin3 >> temp_IP;
     if (fin3.eof()){
-      cerr << "Incorrect Network Configuration" << endl;
+      RM_LOG_ERROR("Incorrect Network Configuration");
       return 1;
     }
     fin3 >> temp_port;
     IPs.push_back(temp_IP);
     ports.push_back(temp_port);
+    locals.push_back(read_local_endpoint(fin3));
   }
 
-  for(size_t i = 0 ; i != info.n ; i++){
-    std::cout << "Server[" << i+1 << "]'s IP/Port: " << IPs[i] + "/" + ports[i] << std::endl;
+  for(size_t i = 0 ; i != num_servers ; i++){
+    RM_LOG_INFO("Server[" << i+1 << "]'s IP/Port: " << IPs[i] + "/" + ports[i] << " " << locals[i]);
   }
   fin1.close();
   fin2.close();
@@ -147,84 +186,67 @@ int main(int argc, char *argv[]){
   /* End of RM Client Setup */
 
   /* Begining of RM Client Main */
-  // create n clients
-  rm_client clients[info.n];
+  // create a client for each server of each committee
+  rm_client clients[num_servers];
 
-  // each client connected to a server
-  for(size_t i = 0 ; i != info.n ;){
+  // connect to every server at once
+  auto connect_start = std::chrono::steady_clock::now();
+  rm_net::connect_all(num_servers, [&](size_t i) {
     clients[i].local_partyID = 1;
-    clients[i].remote_partyID = i+1;
-    if (clients[i].connect(IPs[i], ports[i])) {
-      std::cout << "Connection to Server[" << IPs[i]
-                << " : " << ports[i] << "] established" << std::endl;
-      ++i;
-    } else {
-      std::cout << "Connection to Server[" << IPs[i]
-                << " : " << ports[i] << "] failed" << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(2));
+    clients[i].set_send_budget(send_budget);
+    clients[i].remote_partyID = i%info.n + 1;
+    // servers on this host are reached through their local endpoint
+    bool co_located = !locals[i].empty() && (IPs[i] == "localhost" || IPs[i].rfind("127.", 0) == 0);
+    if (co_located ? clients[i].connect_local(locals[i], 0) : clients[i].connect(IPs[i], ports[i])) {
+      RM_LOG_INFO("Connection to Server[" << IPs[i]
+                << " : " << ports[i] << "] established");
+      return true;
     }
+    RM_LOG_DEBUG("Connection to Server[" << IPs[i]
+              << " : " << ports[i] << "] failed");
+    return false;
+  }, backoff);
+  double connect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - connect_start).count();
+  RM_LOG_INFO("All server connections established in " << connect_ms << " ms");
+
+  std::string metrics_file;
+  metrics_http_server metrics_endpoint;
+  if(!configure_metrics(metrics_endpoint, metrics_file, options))
+  {
+    return 1;
   }
+  metric_histogram& encode_hist = rm_metrics().histogram("rm_client_encode_ms", "Client encoding and sharing time per message");
+  metric_histogram& e2e_hist = rm_metrics().histogram("rm_client_e2e_ms", "Client time from first submission to completion by all servers");
 
   /***********************************************/
   /********* Test Case Generation/Setup **********/
   /***********************************************/
-  size_t prime_idx = 0;
-  size_t L_idx = 0;
-  size_t prime_max_idx = prime_length.size();
-  size_t L_max_idx = L_value.size();
-  std::vector<rm_info> test_cases;
-
-  for(L_idx = 0 ; L_idx != L_max_idx ; L_idx++)
+  std::vector<sweep_run> runs;
+  if(!build_sweep_runs(runs, sweep, info))
   {
-    for(prime_idx = 0 ; prime_idx != prime_max_idx ; prime_idx++)
-    {
-      if(!fft_prime_from_bit_length(info.fft_prime_info, prime_length[prime_idx]))
-      {
-        std::cerr << "Prime Length is Invalid" << std::endl;
-        return 1;
-      }
-      // Mix Parameter Configuration 
-      info.L = L_value[L_idx]; // Mixing parameter L
-      info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed
-      test_cases.emplace_back(info);
-      std::cout << "[Test Case]: Prime Info -> " << test_cases.back().fft_prime_info.two_exponent << ", "
-                                   << test_cases.back().fft_prime_info.odd_factor << ", "
-                                   << test_cases.back().fft_prime_info.zeta << ", "
-                << "# of Msgs -> " << test_cases.back().N << std::endl;
-    }
-  }
-
-  if(!fft_prime_from_bit_length(info.fft_prime_info, test_plen))
-  {
-    std::cerr << "Prime Length is Invalid" << std::endl;
     return 1;
   }
 
-  for(size_t i = 0 ; i != L_value2.size() ; i++)
+  results_writer results;
+  if(!results.open(sweep.results_prefix, "client"))
   {
-    info.L = L_value2[i]; // Mixing parameter L
-    info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed
-    test_cases.emplace_back(info);
-    std::cout << "[Test Case]: Prime Info -> " << test_cases.back().fft_prime_info.two_exponent << ", "
-                                   << test_cases.back().fft_prime_info.odd_factor << ", "
-                                   << test_cases.back().fft_prime_info.zeta << ", "
-                << "# of Msgs -> " << test_cases.back().N << std::endl;
+    return 1;
   }
 
   /*******************************/
   /********* Test Start **********/
   /*******************************/
-  for(size_t case_idx = 0 ; case_idx != test_cases.size() ; case_idx++)
+  for(size_t run_idx = 0 ; run_idx != runs.size() ; run_idx++)
   {
 
-  sid = case_idx;
+  sid = run_idx;
 
   /*******************************/
   /********* Test Setup **********/
   /*******************************/
-  info = test_cases[case_idx];
+  info = runs[run_idx].info;
   NTL::ZZ_p::init(info.fft_prime_info.prime);
-  std::cout << "[*****]: N = " << info.N << ", Prime = " << NTL::NumBits(info.fft_prime_info.prime) << std::endl;
+  RM_LOG_INFO("[*****]: N = " << info.N << ", Prime = " << NTL::NumBits(info.fft_prime_info.prime));
   
   /*******************************/
   /*******************************/
@@ -234,8 +256,14 @@ int main(int argc, char *argv[]){
 
   NTL::vec_ZZ_p input_msgs;
   NTL::vec_ZZ_p xvals = gen_xvals(info.n); // xvalues 1,2,...,n
-  input_msgs.SetLength(info.N);
-  NTL::random(input_msgs,info.N); // sample N random messages
+  size_t total_msgs = info.N * info.committees;
+  input_msgs.SetLength(total_msgs);
+  NTL::random(input_msgs,total_msgs); // sample N random messages per committee
+
+  // the front layer: message m goes to committee slots[m]/N as its client slots[m]%N
+  std::vector<size_t> slots(total_msgs);
+  std::iota(slots.begin(), slots.end(), 0);
+  std::shuffle(slots.begin(), slots.end(), std::mt19937_64(std::random_device{}()));
   /*
   size_t malicious_client = 2;
   for(size_t i = 0 ; i != info.N ; i++)
@@ -249,72 +277,100 @@ int main(int argc, char *argv[]){
   std::chrono::steady_clock::time_point end_tick;
   double encode_lapsed = 0;
 
-  e2e_start_tick = chrono::steady_clock::now();
-
-  // encode, secret-share, and submit messages one by one
-  for(size_t i = 0 ; i != info.N ; i++)
+  uint64_t bytes_before = 0;
+  for(size_t i = 0 ; i != num_servers ; i++)
   {
-    vec_ZZ_p msg_encoding;
-    size_t encoding_length = 7*info.L+5;
+    bytes_before += clients[i].sent_bytes();
+  }
 
-    // additive 2-bases encoding for msg
-    start_tick = chrono::steady_clock::now();
-    add2basis_encode(msg_encoding, input_msgs[i], info.L); 
+  e2e_start_tick = chrono::steady_clock::now();
 
-    if(msg_encoding.length() != encoding_length)
+  // Encode, secret-share, and submit messages on encode_threads workers. A
+  // worker queues each share on the connection to its server, whose io strand
+  // drains it while the worker goes on to encode the next message.
+  NTL::ZZ_pContext context;
+  context.save();
+  std::atomic<size_t> next_msg{0};
+  std::atomic<bool> encoding_failed{false};
+  auto encode_worker = [&]() {
+    rm_client::init_encoder_thread(context);
+    size_t encoding_length = 7*info.L+5;
+    for(size_t m = next_msg++ ; m < total_msgs ; m = next_msg++)
     {
-      std::cout << "Input Encoding Error Occured at message[" << i << "]\n";
-      return 1;
-    }
-
-    // vector of ZZ_p vectors
-    NTL::vec_vec_ZZ_p shared_encodings; 
-    
-    // create n vectors, each to be sent to each server
-    shared_encodings.SetLength(info.n); 
+      vec_ZZ_p msg_encoding;
+      size_t committee = slots[m] / info.N;
+      size_t i = slots[m] % info.N;
 
-    for(size_t j = 0 ; j != encoding_length ; j++)
-    { 
-      vec_ZZ_p temp1; // stores an input to PSS
-      vec_ZZ_p temp2; // stores output shares
+      // additive 2-bases encoding for msg
+      add2basis_encode(msg_encoding, input_msgs[m], info.L); 
 
-      // create a vector include a message to be an input to Packed-SS
-      temp1.append(msg_encoding[j]);
-
-      // sharing scheme takes as inputs a vector of secrets.
-      temp2 = packed_share_secret(xvals, temp1, info.t); 
-      for (size_t k = 0 ; k != info.n ; k++)
+      if(static_cast<size_t>(msg_encoding.length()) != encoding_length)
       {
-        shared_encodings[k].append(temp2[k]);
+        RM_LOG_WARN("Input Encoding Error Occured at message[" << i << "]");
+        encoding_failed = true;
+        return;
       }
+
+      NTL::vec_vec_ZZ_p shared_encodings; // one vector for each server
+      rm_client::share_encoding(shared_encodings, msg_encoding, xvals, info);
+      rm_client::submit_shares(&clients[committee*info.n], shared_encodings, info, sid, i);
     }
-    end_tick = chrono::steady_clock::now();
-    encode_lapsed = encode_lapsed + std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
+  };
+  start_tick = chrono::steady_clock::now();
+  std::vector<std::thread> encoders;
+  for(size_t w = 1 ; w < encode_threads ; w++)
+  {
+    encoders.emplace_back(encode_worker);
+  }
+  encode_worker();
+  for(auto& w : encoders)
+  {
+    w.join();
+  }
+  if(encoding_failed)
+  {
+    return 1;
+  }
+  end_tick = chrono::steady_clock::now();
+  encode_lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
+  // wall-clock time of the whole encoding phase, amortized over the messages
+  double encode_per_msg = encode_lapsed / total_msgs;
+  
+  RM_LOG_INFO("[Encode time]: " << encode_per_msg);
 
-    for(size_t j = 0 ; j != info.n ; j++)
+  // one output per committee
+  std::vector<output_collector> collectors(info.committees, output_collector(sid, info));
+  if(fetch_output)
+  {
+    for(size_t i = 0 ; i != num_servers ; i++)
     {
-      clients[j].submit_message(shared_encodings[j], info, sid, i);
+      clients[i].subscribe_output(sid);
     }
   }
-  
-  std::stringstream s;
-  s << "[Encode time]: " << encode_lapsed/NTL::conv<int>(info.N) << std::endl;
-  std::cout << s.str();
+  auto outputs_done = [&]() {
+    for(auto& c : collectors)
+    {
+      if(!c.done()) return false;
+    }
+    return true;
+  };
 
   //std::cout << "Session[" << sid << "]: all messages submitted\n";
 
   // The following only for testings.
   std::vector<bool> disconnection_status;
   std::vector<bool> completeion_status;
-  disconnection_status.resize(info.n, false);
-  completeion_status.resize(info.n, false);
+  disconnection_status.resize(num_servers, false);
+  completeion_status.resize(num_servers, false);
+  bool rejected = false; // a server declined the session, which will then never complete
 
-  while(!is_all_true(completeion_status))
+  while(!rejected && (!is_all_true(completeion_status) || (fetch_output && !outputs_done())))
   {
-    for(size_t i = 0 ; i != info.n ; i++)
+    for(size_t i = 0 ; i != num_servers ; i++)
     {
       if(clients[i].is_connected())
       {
+        clients[i].poll(); // shared-memory links deliver here
         if(!clients[i].is_incoming_empty())
         {
           rm_net::received_message temp;
@@ -323,6 +379,17 @@ int main(int argc, char *argv[]){
           {
             continue;
           }
+          if(temp.msg.header.mixing_state_id == output_chunk_state)
+          {
+            collectors[i / info.n].add(temp.msg);
+            continue;
+          }
+          if(temp.msg.header.mixing_state_id == session_rejected_state)
+          {
+            RM_LOG_WARN("Session[" << sid << "]: rejected by Server[" << IPs[i] << " : " << ports[i] << "]");
+            rejected = true;
+            break;
+          }
           if(temp.msg.header.mixing_state_id != 15)
           {
             continue;
@@ -336,15 +403,54 @@ int main(int argc, char *argv[]){
     }
   }
   end_tick = chrono::steady_clock::now();
-  auto e2e_lapsed = std::chrono::duration<double, std::milli> (end_tick - e2e_start_tick).count();\
-  std::stringstream s1;
-  s1.clear();
-  s1 << "[e2e time]: " << e2e_lapsed << std::endl;
-  std::cout << s1.str();
+  auto e2e_lapsed = std::chrono::duration<double, std::milli> (end_tick - e2e_start_tick).count();
+  RM_LOG_INFO("[e2e time]: " << e2e_lapsed);
+  if(rejected)
+  {
+    continue; // nothing was mixed, so there is nothing to record
+  }
+  if(fetch_output)
+  {
+    // the committees' outputs merged in sorted order, which hides the shard of each message
+    std::vector<NTL::ZZ_p> output;
+    for(auto& c : collectors)
+    {
+      NTL::vec_ZZ_p part;
+      c.result(part, info.fft_prime_info.prime);
+      for(long j = 0 ; j != part.length() ; j++)
+      {
+        output.push_back(part[j]);
+      }
+    }
+    std::sort(output.begin(), output.end(), [](const NTL::ZZ_p& a, const NTL::ZZ_p& b) {
+      return NTL::rep(a) < NTL::rep(b);
+    });
+    RM_LOG_INFO("Session[" << sid << "]: " << output.size() << " mixed messages received");
+  }
+  for(size_t i = 0 ; i != num_servers ; i++)
+  {
+    RM_LOG_DEBUG(clients[i].stats());
+  }
+  encode_hist.observe(encode_per_msg);
+  e2e_hist.observe(e2e_lapsed);
+  if(!metrics_file.empty())
+  {
+    rm_metrics().write_file(metrics_file);
+  }
+
+  if(!runs[run_idx].warmup)
+  {
+    uint64_t bytes_after = 0;
+    for(size_t i = 0 ; i != num_servers ; i++)
+    {
+      bytes_after += clients[i].sent_bytes();
+    }
+    results.write_client(sid, runs[run_idx], encode_per_msg, e2e_lapsed, bytes_after - bytes_before);
+  }
 
   } // for-loop for test ends
   
-  std::cout << "All Tests Completed.\n";
+  RM_LOG_INFO("All Tests Completed.");
   //int sec = 10; // wait for 'sec' seconds
   //std::this_thread::sleep_for(std::chrono::milliseconds(1000*sec));
   return 0;
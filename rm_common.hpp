@@ -27,11 +27,17 @@
 # SPDX-License-Identifier: MIT
 #
 */
+#pragma once
 #include <iostream>
 #include <utility> 
 #include <assert.h>   
 #include <NTL/ZZ.h>
 #include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
 
 using namespace std;
 
@@ -46,6 +52,9 @@ int test_plen = 256; // 32 bytes
 
 std::vector<int> L_value2({6,10,13,16,18,20,22,23,25,26,27});
 
+// primes of at least this many bits run decompression and sums of powers in RNS lanes
+int rns_min_prime_bits = 512;
+
 // L = 1->23, 2->75, 3->155, 4->263, 5->399, 6->563, 7->755, 8->975, 9->1223, 10->1499, 
 //     11->1803, 12->2135, 13->2495, 14->2883, 15->3299, 16->3743, 17->4215, 18-> 4715, 
 //     19-> 5243, 20->5799, 21-> 6383, 22->6995, 23-> 7635, 24->8303, 25->8999, 26->9723,
@@ -66,8 +75,92 @@ struct rm_info {
   size_t l; // share-packing block size
   size_t N; // the number of clients (or messages to be mixed at an epoch)
   size_t L; // User input L
+  bool rns_mode = false; // compute decompressed sums of powers over word-size RNS lanes
+  size_t num_threads = 1; // worker threads for local computation
+  bool speculative_decom = true; // decompress client inputs in the background as they arrive
+  bool streaming_sums = false; // add each decompressed row into the sums instead of storing the N x N matrix
+  std::string spill_dir; // keep client inputs in memory-mapped files in this directory (empty = in memory)
+  bool huge_page_arena = true; // place session matrices in a huge-page arena released at completion
+  size_t wf_groups = 1; // open this many random combinations of the well-formedness predicates first (0 opens one per client)
+  size_t committees = 1; // committees of n servers, each mixing its own N messages
+  size_t committee = 0; // this server's committee
 };
 
+// parse the optional "--key value" arguments that follow the configuration files
+bool parse_options(int argc, char *argv[], int first, std::multimap<std::string,std::string>& options)
+{
+  for(int i = first ; i < argc ; i += 2)
+  {
+    std::string key(argv[i]);
+    if(key.size() < 3 || key.compare(0, 2, "--") != 0 || i+1 == argc)
+    {
+      std::cerr << "Incorrect option: " << key << std::endl;
+      return false;
+    }
+    options.insert({key.substr(2), std::string(argv[i+1])});
+  }
+  return true;
+}
+
+// --connect-backoff <initial ms>:<max ms>, the retry schedule for connecting
+// to peers; initial and max are left as they are if the option is absent
+void parse_connect_backoff(
+  const std::multimap<std::string,std::string>& options,
+  std::chrono::milliseconds& initial,
+  std::chrono::milliseconds& max)
+{
+  if (options.count("connect-backoff"))
+  {
+    std::string arg = options.find("connect-backoff")->second;
+    size_t colon = arg.find(':');
+    initial = std::chrono::milliseconds(std::stol(arg.substr(0, colon)));
+    if (colon != std::string::npos)
+      max = std::chrono::milliseconds(std::stol(arg.substr(colon+1)));
+  }
+}
+
+// A net_config entry is an IP and a port, optionally followed by the
+// server's endpoint for parties on the same host (unix:<path> or
+// shm:<name>). Returns that endpoint, or "" leaving the stream untouched.
+std::string read_local_endpoint(std::istream& in)
+{
+  std::streampos pos = in.tellg();
+  std::string token;
+  if (in >> token && (token.rfind("unix:", 0) == 0 || token.rfind("shm:", 0) == 0))
+  {
+    return token;
+  }
+  in.clear();
+  in.seekg(pos);
+  return "";
+}
+
+// Optional settings after L in mix_config, one per line. "committees <k>"
+// splits the servers into k committees: net_config then lists k*n servers,
+// committee c being entries c*n+1 to (c+1)*n, and every committee mixes its
+// own N messages of an epoch. "//" and "#" start a comment.
+bool read_mix_options(std::istream& in, size_t& committees)
+{
+  std::string line;
+  while (std::getline(in, line))
+  {
+    line = line.substr(0, std::min(line.find("//"), line.find('#')));
+    std::stringstream ss(line);
+    std::string key;
+    if (!(ss >> key))
+    {
+      continue;
+    }
+    if (key == "committees" && ss >> committees && committees != 0)
+    {
+      continue;
+    }
+    std::cerr << "Incorrect mix configuration: " << line << std::endl;
+    return false;
+  }
+  return true;
+}
+
 // returns the number of true values 
 size_t number_of_truths(const std::vector<bool>& vec)
 {
@@ -0,0 +1,310 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+/* RM Tool Libraries */
+#include "rm_common.hpp"
+#include "secretsharing.h"
+#include "additive2basis.h"
+#include "root_finding.h"
+#include "rm_share_matrix.hpp"
+#include "rm_rns.hpp"
+#include "rm_sweep.hpp"
+#include "rm_metrics.hpp"
+#include "rm_log.hpp"
+
+/* MPC Networking Libraries */
+#include "network_common.hpp"
+#include "network_message.hpp"
+#include "network_ts_queue.hpp"
+#include "network_transport.hpp"
+#include "network_connection.hpp"
+#include "network_server.hpp"
+
+/* RM Client/Server Libraries */
+#include "rm_client.hpp"
+#include "rm_server_stm.hpp"
+#include "rm_server.hpp"
+
+/* Standard Libraries */
+#include <assert.h>
+#include <memory>
+#include <thread>
+#include <utility>
+
+/* NTL Libraries */
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vector.h>
+#include <NTL/vec_ZZ_p.h>
+
+// Runs n mixing servers and the submitting client as threads of one process.
+// Every pair of parties is linked by in-memory transports instead of sockets.
+
+// run server s through session sid and return its stage timings
+stage_timings serve_session(rm_server& server,
+                            rm_client peers[],
+                            rm_info info,
+                            uint32_t sid)
+{
+  NTL::ZZ_p::init(info.fft_prime_info.prime);
+  NTL::ZZ_pX g0 = NTL::BuildFromRoots(gen_xvals(info.n));
+
+  std::shared_ptr<std::map<uint32_t,bool>> corrupted_clients(new std::map<uint32_t,bool>);
+  std::shared_ptr<std::map<uint32_t,bool>> corrupted_servers(new std::map<uint32_t,bool>);
+  for(size_t i = 0 ; i != info.N ; i++){
+    (*corrupted_clients)[i] = false;
+  }
+  for(size_t i = 0 ; i != info.n ; i++){
+    (*corrupted_servers)[i] = false;
+  }
+
+  std::map<uint32_t,std::shared_ptr<rm_mixing_stm>> stms;
+  rm_net::async_queue<rm_net::deserialized_message> deserialized_msgs;
+  while(true)
+  {
+    server.update(info, deserialized_msgs);
+    if(deserialized_msgs.is_empty())
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    while(!deserialized_msgs.is_empty())
+    {
+      auto dm = deserialized_msgs.pop_front();
+      if(stms.find(dm.sid) == stms.end())
+      {
+        std::shared_ptr<rm_mixing_stm> stm(new rm_mixing_stm(info,g0));
+        stm->sid = dm.sid;
+        stm->round_buffers = &server.round_buffers();
+        stms.insert({dm.sid, stm});
+      }
+      stms.at(dm.sid)->message_handler(dm, info);
+      stms.at(dm.sid)->execute_rm_stm(peers, info, corrupted_clients, corrupted_servers);
+      if(stms.at(dm.sid)->get_state() == COMPLETED && dm.sid == sid)
+      {
+        server.unregister_session(sid);
+        return stms.at(dm.sid)->timings;
+      }
+    }
+  }
+}
+
+// encode, share and submit N random messages, as rm_client_main does;
+// returns the mean encoding time per message
+double submit_inputs(rm_client submitters[], const rm_info& info, uint32_t sid)
+{
+  NTL::vec_ZZ_p xvals = gen_xvals(info.n);
+  size_t encoding_length = 7*info.L+5;
+  double encode_lapsed = 0;
+  for(size_t i = 0 ; i != info.N ; i++)
+  {
+    auto start_tick = chrono::steady_clock::now();
+    NTL::vec_ZZ_p msg_encoding;
+    add2basis_encode(&msg_encoding, NTL::random_ZZ_p(), info.L);
+    assert(static_cast<size_t>(msg_encoding.length()) == encoding_length);
+    NTL::vec_vec_ZZ_p shared_encodings;
+    shared_encodings.SetLength(info.n);
+    for(size_t j = 0 ; j != encoding_length ; j++)
+    {
+      NTL::vec_ZZ_p secret;
+      secret.append(msg_encoding[j]);
+      NTL::vec_ZZ_p shares = packed_share_secret(xvals, secret, info.t);
+      for (size_t k = 0 ; k != info.n ; k++)
+      {
+        shared_encodings[k].append(shares[k]);
+      }
+    }
+    encode_lapsed += std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - start_tick).count();
+    for(size_t j = 0 ; j != info.n ; j++)
+    {
+      submitters[j].submit_message(shared_encodings[j], info, sid, i);
+    }
+  }
+  return encode_lapsed / info.N;
+}
+
+// wait until every server has reported session sid as completed
+void wait_for_completion(rm_client submitters[], const rm_info& info, uint32_t sid)
+{
+  std::vector<bool> completion_status(info.n, false);
+  while(!is_all_true(completion_status))
+  {
+    for(size_t i = 0 ; i != info.n ; i++)
+    {
+      submitters[i].poll();
+      while(!submitters[i].is_incoming_empty())
+      {
+        rm_net::received_message temp = submitters[i].access_to_incoming_queue().pop_front();
+        if(temp.msg.header.sid == sid && temp.msg.header.mixing_state_id == COMPLETED)
+        {
+          completion_status[i] = true;
+        }
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+int main(int argc, char *argv[]){
+  std::multimap<std::string,std::string> options;
+  sweep_config sweep;
+  if(!parse_options(argc, argv, 1, options) || !configure_sweep(sweep, options)){
+    RM_LOG_INFO("Usage: ./rm_inproc_main [--servers n] [--threads count] [--io-threads count] [--send-budget bytes] [--speculate 0|1] [--wf-groups count]");
+    RM_LOG_INFO("       [--sweep file] [--case bits:L] [--warmup count] [--reps count] [--results prefix]");
+    return 1;
+  }
+
+  rm_info info;
+  info.n = options.count("servers") ? std::stoul(options.find("servers")->second) : 5;
+  if(info.n%4 != 0){
+    info.t = info.n / 4;
+  }
+  else{
+    info.t = (info.n - 1) / 4;
+  }
+  info.server_id = 0;
+  info.l = 1;
+  info.num_threads = options.count("threads") ? std::stoul(options.find("threads")->second) : 1;
+  info.speculative_decom = !options.count("speculate") || std::stoi(options.find("speculate")->second) != 0;
+  if (options.count("wf-groups")) info.wf_groups = std::stoul(options.find("wf-groups")->second);
+  if(options.count("io-threads"))
+  {
+    rm_net::shared_io_pool().configure(std::stoul(options.find("io-threads")->second));
+  }
+  // bytes each outgoing connection may queue before sends block (0 = unbounded)
+  uint64_t send_budget = options.count("send-budget") ? std::stoull(options.find("send-budget")->second) : 0;
+
+  std::vector<sweep_run> runs;
+  if(!build_sweep_runs(runs, sweep, info))
+  {
+    return 1;
+  }
+  results_writer client_results;
+  std::vector<results_writer> server_results(info.n);
+  if(!client_results.open(sweep.results_prefix, "inproc_client"))
+  {
+    return 1;
+  }
+  for(size_t s = 0 ; s != info.n ; s++)
+  {
+    if(!server_results[s].open(sweep.results_prefix, "inproc_server" + std::to_string(s+1)))
+    {
+      return 1;
+    }
+  }
+
+  // servers[s] accepts from peers[r][s] for every other server r and from submitters[s]
+  std::vector<std::unique_ptr<rm_server>> servers;
+  std::vector<std::unique_ptr<rm_client[]>> peers;
+  std::unique_ptr<rm_client[]> submitters(new rm_client[info.n]);
+  for(size_t s = 0 ; s != info.n ; s++)
+  {
+    servers.emplace_back(new rm_server());
+    servers[s]->start();
+    peers.emplace_back(new rm_client[info.n]);
+  }
+  for(size_t s = 0 ; s != info.n ; s++)
+  {
+    for(size_t r = 0 ; r != info.n ; r++)
+    {
+      peers[s][r].local_partyID = s+1;
+      peers[s][r].set_send_budget(send_budget);
+      peers[s][r].remote_partyID = r+1;
+      if(r == s)
+      {
+        continue; // a server keeps its own shares locally
+      }
+      auto link = rm_net::make_memory_link();
+      peers[s][r].connect_transport(std::move(link.first));
+      servers[r]->accept_transport(std::move(link.second));
+    }
+    auto link = rm_net::make_memory_link();
+    submitters[s].local_partyID = 1;
+    submitters[s].set_send_budget(send_budget);
+    submitters[s].remote_partyID = s+1;
+    submitters[s].connect_transport(std::move(link.first));
+    servers[s]->accept_transport(std::move(link.second));
+  }
+
+  for(size_t run_idx = 0 ; run_idx != runs.size() ; run_idx++)
+  {
+    info = runs[run_idx].info;
+    uint32_t sid = run_idx;
+    NTL::ZZ_p::init(info.fft_prime_info.prime);
+    RM_LOG_INFO("[*****]: N = " << info.N << ", Prime = " << NTL::NumBits(info.fft_prime_info.prime));
+
+    std::vector<uint64_t> bytes_before(info.n, 0);
+    for(size_t s = 0 ; s != info.n ; s++)
+    {
+      for(size_t r = 0 ; r != info.n ; r++)
+      {
+        bytes_before[s] += peers[s][r].sent_bytes();
+      }
+    }
+
+    std::vector<stage_timings> timings(info.n);
+    std::vector<std::thread> workers;
+    for(size_t s = 0 ; s != info.n ; s++)
+    {
+      servers[s]->register_session(sid, info.fft_prime_info.prime);
+      rm_info server_info = info;
+      server_info.server_id = s+1;
+      workers.emplace_back([&, s, server_info]() {
+        timings[s] = serve_session(*servers[s], peers[s].get(), server_info, sid);
+      });
+    }
+
+    auto e2e_start_tick = chrono::steady_clock::now();
+    double encode_ms = submit_inputs(submitters.get(), info, sid);
+    RM_LOG_INFO("[Encode time]: " << encode_ms);
+    wait_for_completion(submitters.get(), info, sid);
+    auto e2e_lapsed = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - e2e_start_tick).count();
+    RM_LOG_INFO("[e2e time]: " << e2e_lapsed);
+
+    for(auto& w : workers)
+    {
+      w.join();
+    }
+    if(!runs[run_idx].warmup)
+    {
+      for(size_t s = 0 ; s != info.n ; s++)
+      {
+        uint64_t bytes_after = 0;
+        for(size_t r = 0 ; r != info.n ; r++)
+        {
+          bytes_after += peers[s][r].sent_bytes();
+        }
+        server_results[s].write_server(sid, runs[run_idx], timings[s], bytes_after - bytes_before[s]);
+      }
+      client_results.write_client(sid, runs[run_idx], encode_ms, e2e_lapsed, 0);
+    }
+  }
+  RM_LOG_INFO("All Tests Completed.");
+  return 0;
+}
@@ -0,0 +1,381 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+/* RM Tool Libraries */
+#include "rm_common.hpp"
+#include "secretsharing.h"
+#include "rm_additive2basis.h"
+#include "rm_sweep.hpp"
+#include "rm_metrics.hpp"
+
+/* MPC Networking Libraries */
+#include "network_common.hpp"
+#include "network_message.hpp"
+#include "network_ts_queue.hpp"
+#include "network_connection.hpp"
+#include "network_client.hpp"
+
+/* RM Client Libraries */
+#include "rm_client.hpp"
+#include "rm_memory_planner.hpp"
+
+/* Standard Libraries */
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <thread>
+
+/* NTL Libraries */
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vector.h>
+#include <NTL/vec_ZZ_p.h>
+
+// Simulates many independent clients submitting to the mixing servers. The
+// N clients of each session (per committee) arrive in bursts at a target
+// rate; encoding workers encode and share each client's message once it has
+// arrived and submit it over one of a pool of connection sets. Reports the
+// latency from each submission to the completion of its session.
+
+struct loadgen_config
+{
+  double rate = 0; // client arrivals per second (0 = all at once)
+  size_t burst = 1; // clients arriving together
+  size_t threads = std::max(1u, std::thread::hardware_concurrency()); // encoding workers
+  size_t conns = 1; // connection sets shared round-robin; N gives every client its own
+};
+
+// arrival times in ms of count clients: bursts of cfg.burst clients with
+// exponential gaps that average cfg.burst/cfg.rate seconds
+std::vector<double> arrival_schedule(size_t count, const loadgen_config& cfg, std::mt19937_64& rng)
+{
+  std::vector<double> arrivals(count, 0);
+  if (cfg.rate <= 0)
+  {
+    return arrivals;
+  }
+  std::exponential_distribution<double> gap(cfg.rate / cfg.burst);
+  double now = 0;
+  for (size_t i = 0 ; i != count ; i++)
+  {
+    if (i != 0 && i % cfg.burst == 0)
+    {
+      now += 1000 * gap(rng);
+    }
+    arrivals[i] = now;
+  }
+  return arrivals;
+}
+
+// the q-quantile of sorted values
+double quantile(const std::vector<double>& sorted, double q)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()));
+  return sorted[idx];
+}
+
+int main(int argc, char *argv[]){
+  std::multimap<std::string,std::string> options;
+  sweep_config sweep;
+  if(argc < 4 || !parse_options(argc, argv, 4, options) || !configure_sweep(sweep, options)){
+    RM_LOG_INFO("Configuration Files Required as Follows:");
+    RM_LOG_INFO("(1) mpc configuration");
+    RM_LOG_INFO("(2) mix configuration");
+    RM_LOG_INFO("(3) network configuration");
+    RM_LOG_INFO("Usage: ./rm_loadgen configs/mpc_config1 configs/mix_config configs/net_config");
+    RM_LOG_INFO("       [--rate clients/s] [--burst clients] [--threads count] [--conns count]");
+    RM_LOG_INFO("       [--sweep file] [--case bits:L] [--warmup count] [--reps count] [--results prefix]");
+    RM_LOG_INFO("       [--metrics-file path] [--metrics-port port] [--log-level 0-4] [--io-threads count] [--send-budget bytes] [--connect-backoff ms:ms]");
+    return 1;
+  }
+  if(options.count("log-level"))
+  {
+    rm_logger::instance().set_level(std::stoi(options.find("log-level")->second));
+  }
+  if(options.count("io-threads"))
+  {
+    rm_net::shared_io_pool().configure(std::stoul(options.find("io-threads")->second));
+  }
+  uint64_t send_budget = options.count("send-budget") ? std::stoull(options.find("send-budget")->second) : 0;
+  // retry schedule for connecting to peers
+  rm_net::connect_backoff backoff;
+  parse_connect_backoff(options, backoff.initial, backoff.max);
+  loadgen_config cfg;
+  if(options.count("rate")) cfg.rate = std::stod(options.find("rate")->second);
+  if(options.count("burst")) cfg.burst = std::max<size_t>(1, std::stoul(options.find("burst")->second));
+  if(options.count("threads")) cfg.threads = std::max<size_t>(1, std::stoul(options.find("threads")->second));
+  if(options.count("conns")) cfg.conns = std::max<size_t>(1, std::stoul(options.find("conns")->second));
+
+  std::ifstream fin1(argv[1]); // mpc config
+  std::ifstream fin2(argv[2]); // mix config
+  std::ifstream fin3(argv[3]); // net config
+  if(!fin1.is_open() || !fin2.is_open() || !fin3.is_open()){
+    RM_LOG_WARN("Reading configuration file failed");
+    return 1;
+  }
+
+  std::string read_param;
+  rm_info info;
+
+  /* Prime Modulus Setup */
+  fin1 >> read_param;
+  if(!fft_prime_from_bit_length(info.fft_prime_info, std::stoi(read_param))){
+    RM_LOG_ERROR("Prime Length is Invalid");
+    return 1;
+  }
+  NTL::ZZ_p::init(info.fft_prime_info.prime);
+
+  /* MPC servers */
+  fin1 >> read_param;
+  info.n = (size_t) std::stoi(read_param);
+  if(info.n%4 != 0){
+    info.t = info.n / 4;
+  }
+  else{
+    info.t = (info.n - 1) / 4;
+  }
+  info.server_id = 0;
+  info.l = 1;
+
+  /* Mix Parameter Configuration */
+  fin2 >> read_param;
+  info.L = (size_t) std::stoi(read_param);
+  info.N = 14 * pow(info.L, 2)+ 10 * info.L - 1;
+  if(!read_mix_options(fin2, info.committees)){
+    return 1;
+  }
+  size_t num_servers = info.n * info.committees;
+
+  /* Network Parameters */
+  std::vector<std::string> IPs;
+  std::vector<std::string> ports;
+  std::vector<std::string> locals;
+  for(size_t i = 0 ; i != num_servers ; i++){
+    std::string temp_IP, temp_port;
+    if (!(fin3 >> temp_IP >> temp_port)){
+      RM_LOG_ERROR("Incorrect Network Configuration");
+      return 1;
+    }
+    IPs.push_back(temp_IP);
+    ports.push_back(temp_port);
+    locals.push_back(read_local_endpoint(fin3));
+  }
+
+  // conns sets of one client per server; once a co-located server's
+  // shared-memory client slots are all taken, later sets use TCP
+  std::vector<std::unique_ptr<rm_client[]>> sets;
+  for(size_t c = 0 ; c != cfg.conns ; c++)
+  {
+    sets.emplace_back(new rm_client[num_servers]);
+    rm_net::connect_all(num_servers, [&](size_t i) {
+      rm_client& client = sets[c][i];
+      client.local_partyID = 1;
+      client.set_send_budget(send_budget);
+      client.remote_partyID = i%info.n + 1;
+      bool co_located = !locals[i].empty() && (IPs[i] == "localhost" || IPs[i].rfind("127.", 0) == 0);
+      if ((co_located && client.connect_local(locals[i], 0)) || client.connect(IPs[i], ports[i])) {
+        return true;
+      }
+      RM_LOG_DEBUG("Connection to Server[" << IPs[i] << " : " << ports[i] << "] failed");
+      return false;
+    }, backoff);
+  }
+  RM_LOG_INFO(cfg.conns << " connection sets to " << num_servers << " servers established");
+
+  std::string metrics_file;
+  metrics_http_server metrics_endpoint;
+  if(!configure_metrics(metrics_endpoint, metrics_file, options))
+  {
+    return 1;
+  }
+  metric_histogram& latency_hist = rm_metrics().histogram("rm_loadgen_latency_ms", "Time from a client's submission to the completion of its session");
+
+  std::vector<sweep_run> runs;
+  if(!build_sweep_runs(runs, sweep, info))
+  {
+    return 1;
+  }
+  results_writer results;
+  if(!results.open(sweep.results_prefix, "loadgen"))
+  {
+    return 1;
+  }
+
+  std::mt19937_64 rng(std::random_device{}());
+  for(size_t run_idx = 0 ; run_idx != runs.size() ; run_idx++)
+  {
+    info = runs[run_idx].info;
+    uint32_t sid = run_idx;
+    NTL::ZZ_p::init(info.fft_prime_info.prime);
+    NTL::ZZ_pContext context;
+    context.save();
+
+    size_t total = info.N * info.committees;
+    std::vector<double> arrivals = arrival_schedule(total, cfg, rng);
+    // the front layer: client m submits to committee slots[m]/N as its client slots[m]%N
+    std::vector<size_t> slots(total);
+    std::iota(slots.begin(), slots.end(), 0);
+    std::shuffle(slots.begin(), slots.end(), rng);
+
+    uint64_t bytes_before = 0;
+    for(auto& set : sets)
+    {
+      for(size_t i = 0 ; i != num_servers ; i++)
+      {
+        bytes_before += set[i].sent_bytes();
+      }
+    }
+
+    std::vector<std::chrono::steady_clock::time_point> submitted(total);
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> encode_us{0};
+    auto start = std::chrono::steady_clock::now();
+    auto worker = [&]() {
+      rm_client::init_encoder_thread(context);
+      NTL::vec_ZZ_p xvals = gen_xvals(info.n);
+      for(size_t m = next++ ; m < total ; m = next++)
+      {
+        std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(arrivals[m] * 1000)));
+        auto encode_start = std::chrono::steady_clock::now();
+        NTL::vec_ZZ_p msg_encoding;
+        add2basis_encode(msg_encoding, NTL::random_ZZ_p(), info.L);
+        NTL::vec_vec_ZZ_p shared_encodings;
+        rm_client::share_encoding(shared_encodings, msg_encoding, xvals, info);
+        encode_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - encode_start).count();
+        size_t committee = slots[m] / info.N;
+        rm_client* set = sets[m % cfg.conns].get();
+        rm_client::submit_shares(&set[committee*info.n], shared_encodings, info, sid, slots[m] % info.N);
+        submitted[m] = std::chrono::steady_clock::now();
+      }
+    };
+    std::vector<std::thread> workers;
+    for(size_t w = 0 ; w != cfg.threads ; w++)
+    {
+      workers.emplace_back(worker);
+    }
+
+    // a committee completes when each of its servers has reported so on some connection
+    std::vector<bool> reported(num_servers, false);
+    std::vector<std::chrono::steady_clock::time_point> completed(info.committees);
+    std::vector<bool> committee_done(info.committees, false);
+    bool rejected = false;
+    while(!is_all_true(committee_done))
+    {
+      for(auto& set : sets)
+      {
+        for(size_t i = 0 ; i != num_servers ; i++)
+        {
+          set[i].poll();
+          while(!set[i].is_incoming_empty())
+          {
+            rm_net::received_message temp = set[i].access_to_incoming_queue().pop_front();
+            if(temp.msg.header.sid == sid && temp.msg.header.mixing_state_id == 15) // COMPLETED
+            {
+              reported[i] = true;
+            }
+            if(temp.msg.header.sid == sid && temp.msg.header.mixing_state_id == session_rejected_state)
+            {
+              // the committee's session will never complete
+              size_t c = i / info.n;
+              std::fill(reported.begin() + c*info.n, reported.begin() + (c+1)*info.n, true);
+              rejected = true;
+            }
+          }
+        }
+      }
+      for(size_t c = 0 ; c != info.committees ; c++)
+      {
+        if(!committee_done[c] && std::all_of(reported.begin() + c*info.n, reported.begin() + (c+1)*info.n, [](bool b) { return b; }))
+        {
+          committee_done[c] = true;
+          completed[c] = std::chrono::steady_clock::now();
+        }
+      }
+      std::this_thread::yield();
+    }
+    for(auto& w : workers)
+    {
+      w.join();
+    }
+
+    if(rejected)
+    {
+      RM_LOG_WARN("[LOADGEN] sid=" << sid << " rejected by a server");
+      continue;
+    }
+    std::vector<double> latencies(total);
+    for(size_t m = 0 ; m != total ; m++)
+    {
+      latencies[m] = std::chrono::duration<double, std::milli>(completed[slots[m] / info.N] - submitted[m]).count();
+      latency_hist.observe(latencies[m]);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double span_ms = std::chrono::duration<double, std::milli>(*std::max_element(completed.begin(), completed.end()) - start).count();
+    double encode_ms = encode_us / 1000.0 / total;
+    std::stringstream s;
+    s << "[LOADGEN] sid=" << sid
+      << " clients=" << total
+      << " rate=" << cfg.rate
+      << " burst=" << cfg.burst
+      << " threads=" << cfg.threads
+      << " conns=" << cfg.conns
+      << " p50_ms=" << quantile(latencies, 0.5)
+      << " p90_ms=" << quantile(latencies, 0.9)
+      << " p99_ms=" << quantile(latencies, 0.99)
+      << " max_ms=" << latencies.back()
+      << " throughput=" << total / (span_ms / 1000) << "/s";
+    RM_LOG_INFO(s.str());
+    if(!metrics_file.empty())
+    {
+      rm_metrics().write_file(metrics_file);
+    }
+    if(!runs[run_idx].warmup)
+    {
+      uint64_t bytes_after = 0;
+      for(auto& set : sets)
+      {
+        for(size_t i = 0 ; i != num_servers ; i++)
+        {
+          bytes_after += set[i].sent_bytes();
+        }
+      }
+      results.write_client(sid, runs[run_idx], encode_ms, span_ms, bytes_after - bytes_before);
+    }
+  }
+  RM_LOG_INFO("All Load Runs Completed.");
+  return 0;
+}
@@ -0,0 +1,235 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Leveled logging through a lock-free ring. Callers format a line on their
+// own thread and copy it into the ring; a background thread writes the ring
+// to stdout (stderr for warnings and errors), so no socket completion handler
+// or state machine step ever waits on the console.
+//
+// RM_LOG_LEVEL removes the levels below it at compile time, e.g.
+// -DRM_LOG_LEVEL=0 keeps the per-message TRACE lines of the network layer.
+
+#define RM_LOG_LEVEL_TRACE 0
+#define RM_LOG_LEVEL_DEBUG 1
+#define RM_LOG_LEVEL_INFO  2
+#define RM_LOG_LEVEL_WARN  3
+#define RM_LOG_LEVEL_ERROR 4
+
+#ifndef RM_LOG_LEVEL
+#define RM_LOG_LEVEL RM_LOG_LEVEL_DEBUG
+#endif
+
+class rm_logger
+{
+  public:
+    static constexpr size_t capacity = 16384; // slots, a power of two
+    static constexpr size_t slot_text = 116; // line bytes per slot
+
+    static rm_logger& instance()
+    {
+      static rm_logger logger;
+      return logger;
+    }
+
+    ~rm_logger()
+    {
+      running.store(false);
+      if (flusher.joinable())
+        flusher.join();
+      drain();
+    }
+
+    void set_level(int level) { min_level.store(level, std::memory_order_relaxed); }
+    bool enabled(int level) const { return level >= min_level.load(std::memory_order_relaxed); }
+
+    // copy a line into consecutive slots; the line is dropped if the ring is full
+    void push(int level, const std::string& line)
+    {
+      size_t num_slots = line.empty() ? 1 : (line.size() + slot_text - 1) / slot_text;
+      if (num_slots > capacity / 4)
+      {
+        num_slots = capacity / 4; // truncate absurdly long lines
+      }
+      size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+      while (true)
+      {
+        // slots are released in order, so the last one being free frees them all
+        size_t last = pos + num_slots - 1;
+        size_t seq = ring[last & (capacity - 1)].seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(last);
+        if (diff == 0)
+        {
+          if (enqueue_pos.compare_exchange_weak(pos, pos + num_slots, std::memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0)
+        {
+          dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        else
+        {
+          pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+      }
+      for (size_t k = 0 ; k != num_slots ; k++)
+      {
+        slot& s = ring[(pos + k) & (capacity - 1)];
+        size_t offset = k * slot_text;
+        s.len = static_cast<uint16_t>(std::min(slot_text, line.size() - std::min(offset, line.size())));
+        std::memcpy(s.text, line.data() + std::min(offset, line.size()), s.len);
+        s.level = static_cast<uint8_t>(level);
+        s.more = (k + 1 != num_slots);
+        s.seq.store(pos + k + 1, std::memory_order_release);
+      }
+    }
+
+  private:
+    struct slot
+    {
+      std::atomic<size_t> seq;
+      uint16_t len;
+      uint8_t level;
+      bool more; // the line continues in the next slot
+      char text[slot_text];
+    };
+
+    rm_logger() : ring(capacity)
+    {
+      for (size_t i = 0 ; i != capacity ; i++)
+      {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+      }
+      flusher = std::thread([this]() {
+        while (running.load())
+        {
+          if (!drain())
+          {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        }
+      });
+    }
+
+    // write out every published line; returns false if there was none
+    bool drain()
+    {
+      std::string out, err;
+      bool any = false;
+      while (true)
+      {
+        slot& s = ring[dequeue_pos & (capacity - 1)];
+        if (s.seq.load(std::memory_order_acquire) != dequeue_pos + 1)
+          break;
+        std::string& dst = (s.level >= RM_LOG_LEVEL_WARN) ? err : out;
+        dst.append(s.text, s.len);
+        if (!s.more)
+          dst.push_back('\n');
+        s.seq.store(dequeue_pos + capacity, std::memory_order_release);
+        dequeue_pos++;
+        any = true;
+      }
+      uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+      if (lost != 0)
+      {
+        err += "[LOG] " + std::to_string(lost) + " lines dropped\n";
+      }
+      if (!out.empty())
+      {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+      }
+      if (!err.empty())
+      {
+        std::fwrite(err.data(), 1, err.size(), stderr);
+        std::fflush(stderr);
+      }
+      return any;
+    }
+
+    std::vector<slot> ring;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) size_t dequeue_pos = 0; // flusher only
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<int> min_level{RM_LOG_LEVEL};
+    std::atomic<bool> running{true};
+    std::thread flusher;
+};
+
+// a per-thread stream reused for formatting lines
+inline std::ostringstream& rm_log_stream()
+{
+  thread_local std::ostringstream s;
+  s.str("");
+  s.clear();
+  return s;
+}
+
+#define RM_LOG(level, expr) \
+  do { \
+    if (rm_logger::instance().enabled(level)) \
+    { \
+      std::ostringstream& rm_log_s = rm_log_stream(); \
+      rm_log_s << expr; \
+      rm_logger::instance().push(level, rm_log_s.str()); \
+    } \
+  } while (0)
+
+#if RM_LOG_LEVEL <= RM_LOG_LEVEL_TRACE
+#define RM_LOG_TRACE(expr) RM_LOG(RM_LOG_LEVEL_TRACE, expr)
+#else
+#define RM_LOG_TRACE(expr) do {} while (0)
+#endif
+
+#if RM_LOG_LEVEL <= RM_LOG_LEVEL_DEBUG
+#define RM_LOG_DEBUG(expr) RM_LOG(RM_LOG_LEVEL_DEBUG, expr)
+#else
+#define RM_LOG_DEBUG(expr) do {} while (0)
+#endif
+
+#if RM_LOG_LEVEL <= RM_LOG_LEVEL_INFO
+#define RM_LOG_INFO(expr) RM_LOG(RM_LOG_LEVEL_INFO, expr)
+#else
+#define RM_LOG_INFO(expr) do {} while (0)
+#endif
+
+#define RM_LOG_WARN(expr) RM_LOG(RM_LOG_LEVEL_WARN, expr)
+#define RM_LOG_ERROR(expr) RM_LOG(RM_LOG_LEVEL_ERROR, expr)
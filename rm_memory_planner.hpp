@@ -0,0 +1,179 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <NTL/ZZ.h>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include "rm_common.hpp"
+#include "rm_log.hpp"
+#include "rm_metrics.hpp"
+#include "rm_share_matrix.hpp"
+#include "network_message.hpp"
+#include "network_connection.hpp"
+
+// Message state of a session a server declined to run, after the output
+// delivery states of rm_output.hpp
+const uint16_t session_rejected_state = 19;
+
+// Expected bytes a session holds at each stage on one server
+struct memory_plan
+{
+  uint64_t inputs = 0; // client inputs and the well-formedness check
+  uint64_t sums = 0;   // decompression and sums of powers
+  uint64_t roots = 0;  // opening the sums, Newton's identities and root finding
+
+  uint64_t peak() const { return std::max(inputs, std::max(sums, roots)); }
+};
+
+// bytes of a rows x cols share_matrix for elements mod prime
+uint64_t share_matrix_bytes(size_t rows, size_t cols, const NTL::ZZ& prime)
+{
+  uint64_t limbs = (NTL::NumBytes(prime) + 7) / 8;
+  uint64_t col_stride = (rows * limbs * 8 + 63) / 64 * 64;
+  return col_stride * cols;
+}
+
+// bytes of one heap-allocated ZZ_p: the limbs, NTL's header and malloc's
+uint64_t zz_p_bytes(const NTL::ZZ& prime)
+{
+  return ((NTL::NumBytes(prime) + 7) / 8 + 5) * 8;
+}
+
+// Estimate the peak memory of each stage from N, L, n and the prime under
+// the strategy info selects (rns_mode, speculative_decom, streaming_sums).
+memory_plan estimate_session_memory(const rm_info& info)
+{
+  const NTL::ZZ& prime = info.fft_prime_info.prime;
+  uint64_t zz = zz_p_bytes(prime);
+  uint64_t input = share_matrix_bytes(info.N, 7*info.L+5, prime);
+  if (!info.spill_dir.empty())
+  {
+    input = std::min<uint64_t>(input, 2 * share_matrix::tile_bytes); // a mapped file holds them, read a tile at a time
+  }
+  uint64_t opening = info.N * info.n * zz; // one round of batched open shares (l = 1)
+
+  memory_plan plan;
+  plan.inputs = input + info.N * zz + opening; // predicates and their opening
+  if (info.rns_mode)
+  {
+    // lanes as chosen by rns_basis::init
+    uint64_t target_bits = 2*NTL::NumBits(prime) + NTL::NumBits(static_cast<long>(info.N)) + 1;
+    uint64_t lanes = target_bits / 49 + 1;
+    plan.sums = input + lanes * info.N * (7*info.L+5) * 8;
+    plan.inputs = std::max(plan.inputs, info.speculative_decom ? plan.sums : 0);
+  }
+  else if (info.speculative_decom || info.streaming_sums)
+  {
+    plan.sums = input + info.N * zz; // rows are summed as they are decompressed
+  }
+  else
+  {
+    plan.sums = input + share_matrix_bytes(info.N, info.N, prime);
+  }
+  plan.roots = opening + 16 * info.N * zz; // polynomial arithmetic of degree N
+  return plan;
+}
+
+// Choose the strategy for a session to fit in budget bytes (0 = unlimited):
+// the configured one if it fits, otherwise summing decompressed rows as they
+// are produced instead of storing the N x N matrix or the RNS lanes. Returns
+// false if even that does not fit; info is updated with the choice.
+bool plan_session_memory(rm_info& info, uint64_t budget, memory_plan& plan)
+{
+  plan = estimate_session_memory(info);
+  if (budget == 0 || plan.peak() <= budget)
+  {
+    return true;
+  }
+  rm_info streaming = info;
+  streaming.rns_mode = false;
+  streaming.streaming_sums = true;
+  memory_plan fallback = estimate_session_memory(streaming);
+  if (fallback.peak() > budget)
+  {
+    RM_LOG_WARN("Session with N = " << info.N << " needs about " << fallback.peak() << " bytes, over the memory budget of " << budget);
+    return false;
+  }
+  RM_LOG_INFO("Session with N = " << info.N << " would need about " << plan.peak()
+            << " bytes; summing powers row by row to stay within " << budget);
+  info = streaming;
+  plan = fallback;
+  return true;
+}
+
+// Sessions this server will not run. Their later messages are dropped, and
+// every connection that submits to one is told so once.
+class session_rejections
+{
+  public:
+    void reject(uint32_t sid)
+    {
+      if (rejected.insert({sid, {}}).second)
+      {
+        rm_metrics().counter("rm_sessions_rejected_total", "Sessions declined for lack of memory or by a peer").inc();
+      }
+    }
+
+    bool is_rejected(uint32_t sid) const
+    {
+      return rejected.count(sid) != 0;
+    }
+
+    void notify(uint32_t sid, uint32_t sender_id, const std::shared_ptr<rm_net::connection>& conn)
+    {
+      auto it = rejected.find(sid);
+      if (it == rejected.end() || !conn || !it->second.insert(conn).second)
+      {
+        return;
+      }
+      conn->send_message(rejection(sid, sender_id));
+    }
+
+    static rm_net::message rejection(uint32_t sid, uint32_t sender_id)
+    {
+      rm_net::message msg;
+      msg.header.sid = sid;
+      msg.header.sender_id = sender_id;
+      msg.header.mixing_state_id = session_rejected_state;
+      msg.header.block_idx = 1;
+      msg.header.tot_num_blocks = 1;
+      msg.header.dimension = 1;
+      msg.header.num_ZZ_p = 0;
+      msg.header.size = 0;
+      msg.header.time = std::chrono::system_clock::now();
+      return msg;
+    }
+
+  private:
+    std::map<uint32_t, std::set<std::shared_ptr<rm_net::connection>>> rejected;
+};
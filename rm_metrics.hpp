@@ -0,0 +1,337 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <boost/asio.hpp>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rm_log.hpp"
+
+// Counters, gauges and latency histograms updated with relaxed atomics on the
+// hot path. Metrics are registered once by name and labels; callers keep the
+// returned reference so that an update never takes the registry lock.
+
+class metric_counter
+{
+  public:
+    void inc(uint64_t v = 1) { value.fetch_add(v, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> value{0};
+};
+
+class metric_gauge
+{
+  public:
+    void set(int64_t v) { value.store(v, std::memory_order_relaxed); }
+    void add(int64_t v) { value.fetch_add(v, std::memory_order_relaxed); }
+    int64_t get() const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<int64_t> value{0};
+};
+
+// A latency histogram in milliseconds with fixed upper bounds. The sum is kept
+// in microseconds so that it can be accumulated atomically.
+class metric_histogram
+{
+  public:
+    explicit metric_histogram(const std::vector<double>& upper_bounds)
+    : bounds(upper_bounds), counts(upper_bounds.size() + 1)
+    {
+    }
+
+    void observe(double ms)
+    {
+      size_t b = std::lower_bound(bounds.begin(), bounds.end(), ms) - bounds.begin();
+      counts[b].fetch_add(1, std::memory_order_relaxed);
+      sum_us.fetch_add(static_cast<uint64_t>(std::max(ms, 0.0) * 1000), std::memory_order_relaxed);
+    }
+
+    const std::vector<double>& upper_bounds() const { return bounds; }
+    uint64_t bucket(size_t b) const { return counts[b].load(std::memory_order_relaxed); }
+    double sum_ms() const { return sum_us.load(std::memory_order_relaxed) / 1000.0; }
+
+  private:
+    std::vector<double> bounds;
+    std::vector<std::atomic<uint64_t>> counts; // the last bucket is +Inf
+    std::atomic<uint64_t> sum_us{0};
+};
+
+// default histogram bounds: 0.1 ms to about 100 s, roughly 2.5x apart
+std::vector<double> default_latency_bounds()
+{
+  return {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+}
+
+class metrics_registry
+{
+  public:
+    // labels are given in Prometheus form, e.g. "stage=\"DECOM\"", or empty
+    metric_counter& counter(const std::string& name, const std::string& help, const std::string& labels = "")
+    {
+      std::scoped_lock lock(mtx);
+      family& f = get_family(name, help, "counter");
+      auto& m = f.counters[labels];
+      if (!m) m.reset(new metric_counter);
+      return *m;
+    }
+
+    metric_gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "")
+    {
+      std::scoped_lock lock(mtx);
+      family& f = get_family(name, help, "gauge");
+      auto& m = f.gauges[labels];
+      if (!m) m.reset(new metric_gauge);
+      return *m;
+    }
+
+    metric_histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "")
+    {
+      std::scoped_lock lock(mtx);
+      family& f = get_family(name, help, "histogram");
+      auto& m = f.histograms[labels];
+      if (!m) m.reset(new metric_histogram(default_latency_bounds()));
+      return *m;
+    }
+
+    // write all metrics in the Prometheus text exposition format
+    void write_prometheus(std::ostream& out)
+    {
+      std::scoped_lock lock(mtx);
+      for (auto& fam : families)
+      {
+        const family& f = fam.second;
+        out << "# HELP " << fam.first << " " << f.help << "\n";
+        out << "# TYPE " << fam.first << " " << f.type << "\n";
+        for (auto& m : f.counters)
+        {
+          out << fam.first << braces(m.first) << " " << m.second->get() << "\n";
+        }
+        for (auto& m : f.gauges)
+        {
+          out << fam.first << braces(m.first) << " " << m.second->get() << "\n";
+        }
+        for (auto& m : f.histograms)
+        {
+          const metric_histogram& h = *m.second;
+          std::string sep = m.first.empty() ? "" : ",";
+          uint64_t cumulative = 0;
+          for (size_t b = 0 ; b != h.upper_bounds().size() ; b++)
+          {
+            cumulative += h.bucket(b);
+            out << fam.first << "_bucket{" << m.first << sep << "le=\"" << h.upper_bounds()[b] << "\"} " << cumulative << "\n";
+          }
+          cumulative += h.bucket(h.upper_bounds().size());
+          out << fam.first << "_bucket{" << m.first << sep << "le=\"+Inf\"} " << cumulative << "\n";
+          out << fam.first << "_sum" << braces(m.first) << " " << h.sum_ms() << "\n";
+          out << fam.first << "_count" << braces(m.first) << " " << cumulative << "\n";
+        }
+      }
+    }
+
+    // replace filename with a snapshot; the rename keeps readers from seeing a partial file
+    bool write_file(const std::string& filename)
+    {
+      std::string temp = filename + ".tmp";
+      {
+        std::ofstream fout(temp);
+        if (!fout.is_open())
+        {
+          RM_LOG_ERROR("Writing metrics file failed: " << filename);
+          return false;
+        }
+        write_prometheus(fout);
+      }
+      return std::rename(temp.c_str(), filename.c_str()) == 0;
+    }
+
+  private:
+    struct family
+    {
+      std::string help;
+      std::string type;
+      std::map<std::string,std::unique_ptr<metric_counter>> counters;
+      std::map<std::string,std::unique_ptr<metric_gauge>> gauges;
+      std::map<std::string,std::unique_ptr<metric_histogram>> histograms;
+    };
+
+    family& get_family(const std::string& name, const std::string& help, const char* type)
+    {
+      family& f = families[name];
+      if (f.type.empty())
+      {
+        f.help = help;
+        f.type = type;
+      }
+      assert(f.type == type);
+      return f;
+    }
+
+    static std::string braces(const std::string& labels)
+    {
+      return labels.empty() ? "" : "{" + labels + "}";
+    }
+
+    std::mutex mtx;
+    std::map<std::string,family> families;
+};
+
+// the process-wide registry
+metrics_registry& rm_metrics()
+{
+  static metrics_registry registry;
+  return registry;
+}
+
+// Serves GET /metrics on a local port from its own thread. Each request is
+// answered with the current snapshot and the connection is closed.
+class metrics_http_server
+{
+  public:
+    metrics_http_server() : acceptor(context) {}
+
+    ~metrics_http_server() { stop(); }
+
+    bool start(uint16_t port)
+    {
+      try
+      {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), port);
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        accept();
+        worker = std::thread([this]() { context.run(); });
+      }
+      catch (std::exception& e)
+      {
+        RM_LOG_ERROR("Metrics endpoint exception thrown: " << e.what());
+        return false;
+      }
+      RM_LOG_INFO("Metrics served at http://127.0.0.1:" << port << "/metrics");
+      return true;
+    }
+
+    void stop()
+    {
+      context.stop();
+      if (worker.joinable())
+        worker.join();
+    }
+
+  private:
+    void accept()
+    {
+      acceptor.async_accept(
+        [this](std::error_code ec, boost::asio::ip::tcp::socket socket)
+        {
+          if (!ec)
+          {
+            auto conn = std::make_shared<request>(std::move(socket));
+            boost::asio::async_read_until(conn->socket, conn->buffer, "\r\n\r\n",
+              [conn](std::error_code ec, std::size_t)
+              {
+                if (ec)
+                {
+                  return;
+                }
+                std::string line;
+                std::istream in(&conn->buffer);
+                std::getline(in, line);
+                std::stringstream body;
+                std::string status = "200 OK";
+                if (line.compare(0, 13, "GET /metrics ") == 0)
+                {
+                  rm_metrics().write_prometheus(body);
+                }
+                else
+                {
+                  status = "404 Not Found";
+                }
+                std::stringstream s;
+                s << "HTTP/1.1 " << status << "\r\n"
+                  << "Content-Type: text/plain; version=0.0.4\r\n"
+                  << "Content-Length: " << body.str().size() << "\r\n"
+                  << "Connection: close\r\n\r\n" << body.str();
+                conn->response = s.str();
+                boost::asio::async_write(conn->socket, boost::asio::buffer(conn->response),
+                  [conn](std::error_code, std::size_t)
+                  {
+                    conn->socket.close();
+                  });
+              });
+          }
+          accept();
+        });
+    }
+
+    struct request
+    {
+      explicit request(boost::asio::ip::tcp::socket s) : socket(std::move(s)) {}
+      boost::asio::ip::tcp::socket socket;
+      boost::asio::streambuf buffer;
+      std::string response;
+    };
+
+    boost::asio::io_context context;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread worker;
+};
+
+// Apply the metrics options of the mains: --metrics-file <path> names a file
+// rewritten after every session and --metrics-port <port> serves /metrics.
+bool configure_metrics(metrics_http_server& endpoint,
+                       std::string& metrics_file,
+                       const std::multimap<std::string,std::string>& options)
+{
+  if (options.count("metrics-file"))
+  {
+    metrics_file = options.find("metrics-file")->second;
+  }
+  if (options.count("metrics-port"))
+  {
+    return endpoint.start(static_cast<uint16_t>(std::stoi(options.find("metrics-port")->second)));
+  }
+  return true;
+}
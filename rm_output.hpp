@@ -0,0 +1,268 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vec_ZZ_p.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include "rm_common.hpp"
+#include "rm_metrics.hpp"
+#include "network_message.hpp"
+#include "network_connection.hpp"
+
+// Message states of output delivery, after the mixing states of rm_server_stm.hpp
+const uint16_t output_subscribe_state = 17; // client -> server: send me the output of sid
+const uint16_t output_chunk_state = 18;     // server -> client: one chunk of that output
+
+// A server's outputs of its recent sessions. The roots of a session are
+// sorted by value so that all honest servers send identical bytes, serialized
+// once into chunks, and sent to every subscriber of the session, whether it
+// subscribed before or after the session completed. Sessions complete in
+// sid order, so subscribers of a session older than the kept ones are let go.
+class output_publisher
+{
+  public:
+    output_publisher(size_t chunk = 4096, size_t sessions = 8)
+      : chunk_elems(std::max<size_t>(1, std::min<size_t>(chunk, 65535))), keep(sessions)
+    {}
+
+    void publish(uint32_t sid, const NTL::vec_ZZ_p& output, const rm_info& info)
+    {
+      std::vector<NTL::ZZ_p> sorted(output.length());
+      for (long i = 0 ; i != output.length() ; i++)
+      {
+        sorted[i] = output[i];
+      }
+      std::sort(sorted.begin(), sorted.end(), [](const NTL::ZZ_p& a, const NTL::ZZ_p& b) {
+        return NTL::rep(a) < NTL::rep(b);
+      });
+      size_t num_chunks = std::max<size_t>(1, (sorted.size() + chunk_elems - 1) / chunk_elems);
+      std::vector<rm_net::message>& chunks = published[sid];
+      chunks.resize(num_chunks);
+      for (size_t c = 0 ; c != num_chunks ; c++)
+      {
+        NTL::vec_ZZ_p part;
+        for (size_t i = c*chunk_elems ; i < sorted.size() && i < (c+1)*chunk_elems ; i++)
+        {
+          part.append(sorted[i]);
+        }
+        rm_net::message& msg = chunks[c];
+        msg.header.sid = sid;
+        msg.header.sender_id = info.server_id;
+        msg.header.mixing_state_id = output_chunk_state;
+        msg.header.block_idx = c+1;
+        msg.header.tot_num_blocks = num_chunks;
+        msg.header.dimension = 1;
+        serialize_from_vec_ZZ_p(msg, part, info.fft_prime_info.prime);
+        msg.header.size = msg.body.size();
+      }
+      auto it = waiting.find(sid);
+      if (it != waiting.end())
+      {
+        for (size_t k = 0 ; k != it->second.size() ; k++)
+        {
+          // with nothing kept, the last subscriber gets the chunks themselves
+          if (keep == 0 && k+1 == it->second.size())
+            send_chunks(std::move(chunks), it->second[k]);
+          else
+            send_chunks(chunks, it->second[k]);
+        }
+        waiting.erase(it);
+      }
+      order.push_back(sid);
+      while (order.size() > keep)
+      {
+        published.erase(order.front());
+        order.pop_front();
+      }
+      oldest = order.empty() ? sid + 1 : order.front();
+      waiting.erase(waiting.begin(), waiting.lower_bound(oldest));
+    }
+
+    void subscribe(uint32_t sid, const std::shared_ptr<rm_net::connection>& conn)
+    {
+      auto it = published.find(sid);
+      if (it != published.end())
+      {
+        send_chunks(it->second, conn);
+      }
+      else if (sid >= oldest)
+      {
+        waiting[sid].push_back(conn);
+      }
+    }
+
+    // let go of the subscribers of a session that will never be published
+    void drop(uint32_t sid)
+    {
+      waiting.erase(sid);
+    }
+
+  private:
+    void send_chunks(const std::vector<rm_net::message>& chunks, const std::shared_ptr<rm_net::connection>& conn)
+    {
+      if (!conn || !conn->is_connected())
+      {
+        return;
+      }
+      for (auto& msg : chunks)
+      {
+        conn->send_message(msg);
+      }
+      chunks_sent().inc(chunks.size());
+    }
+
+    void send_chunks(std::vector<rm_net::message>&& chunks, const std::shared_ptr<rm_net::connection>& conn)
+    {
+      if (!conn || !conn->is_connected())
+      {
+        return;
+      }
+      for (auto& msg : chunks)
+      {
+        conn->send_message(std::move(msg));
+      }
+      chunks_sent().inc(chunks.size());
+    }
+
+    static metric_counter& chunks_sent()
+    {
+      static metric_counter& c = rm_metrics().counter("rm_output_chunks_sent_total", "Output chunks sent to subscribers");
+      return c;
+    }
+
+    size_t chunk_elems; // elements per chunk; num_ZZ_p is 16 bits wide
+    size_t keep; // sessions whose output is kept for late subscribers
+    std::map<uint32_t, std::vector<rm_net::message>> published;
+    std::deque<uint32_t> order; // published sids, oldest first
+    uint32_t oldest = 0; // sessions before this one are no longer served
+    std::map<uint32_t, std::vector<std::shared_ptr<rm_net::connection>>> waiting; // subscribers of sessions not completed yet
+};
+
+// Collects the chunks of one session's output from several servers and
+// settles on the output that t+1 of them sent byte for byte, which at least
+// one honest server vouches for.
+class output_collector
+{
+  public:
+    output_collector(uint32_t session, const rm_info& info)
+      : sid(session), t(info.t), outputs(info.n)
+    {}
+
+    // take one chunk; true once the output is settled
+    bool add(const rm_net::message& msg)
+    {
+      uint32_t from = msg.header.sender_id;
+      if (msg.header.sid != sid || msg.header.mixing_state_id != output_chunk_state
+          || from == 0 || from > outputs.size() || msg.header.tot_num_blocks == 0
+          || msg.header.block_idx == 0 || msg.header.block_idx > msg.header.tot_num_blocks)
+      {
+        return done();
+      }
+      server_output& out = outputs[from-1];
+      if (out.chunks.empty())
+      {
+        out.chunks.resize(msg.header.tot_num_blocks);
+        out.got.resize(msg.header.tot_num_blocks, false);
+      }
+      if (out.chunks.size() != msg.header.tot_num_blocks || out.got[msg.header.block_idx-1])
+      {
+        return done();
+      }
+      out.chunks[msg.header.block_idx-1] = msg;
+      out.got[msg.header.block_idx-1] = true;
+      out.received++;
+      if (!done() && out.complete())
+      {
+        size_t votes = 0;
+        for (auto& other : outputs)
+        {
+          if (other.complete() && other.same_as(out))
+          {
+            votes++;
+          }
+        }
+        if (votes >= t+1)
+        {
+          settled = from;
+        }
+      }
+      return done();
+    }
+
+    bool done() const { return settled != 0; }
+
+    // the settled output in sorted order
+    void result(NTL::vec_ZZ_p& output, const NTL::ZZ& prime) const
+    {
+      output.kill();
+      if (!done())
+      {
+        return;
+      }
+      for (auto msg : outputs[settled-1].chunks)
+      {
+        NTL::vec_ZZ_p part;
+        deserialize_to_vec_ZZ_p(part, msg, prime);
+        output.append(part);
+      }
+    }
+
+  private:
+    struct server_output
+    {
+      std::vector<rm_net::message> chunks; // by block index
+      std::vector<bool> got;
+      size_t received = 0;
+
+      bool complete() const { return !chunks.empty() && received == chunks.size(); }
+
+      bool same_as(const server_output& other) const
+      {
+        if (chunks.size() != other.chunks.size())
+          return false;
+        for (size_t c = 0 ; c != chunks.size() ; c++)
+        {
+          if (chunks[c].header.num_ZZ_p != other.chunks[c].header.num_ZZ_p || chunks[c].body != other.chunks[c].body)
+            return false;
+        }
+        return true;
+      }
+    };
+
+    uint32_t sid;
+    size_t t;
+    std::vector<server_output> outputs; // by server id - 1
+    uint32_t settled = 0; // the server whose output t+1 servers agree on
+};
@@ -0,0 +1,348 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <assert.h>
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vec_ZZ_p.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "rm_common.hpp"
+#include "rm_log.hpp"
+#include "rm_metrics.hpp"
+#include "rm_sweep.hpp"
+#include "network_message.hpp"
+
+// Input-independent randomness of future sessions in a file mapped into
+// memory: one record per sid holding the common coin seed. A record is
+// consumed at most once, also across restarts.
+class preprocessing_store
+{
+  public:
+    preprocessing_store() {}
+    preprocessing_store(const preprocessing_store&) = delete;
+    preprocessing_store& operator=(const preprocessing_store&) = delete;
+
+    ~preprocessing_store()
+    {
+      if (base != nullptr)
+        munmap(base, length);
+    }
+
+    // map path for sessions [first, first+count) with elements of elem_bytes,
+    // starting over if the file holds a different range
+    bool open(const std::string& path, uint32_t first, uint32_t count, uint64_t elem_bytes)
+    {
+      int fd = ::open(path.c_str(), O_CREAT | O_RDWR, 0600);
+      if (fd < 0)
+      {
+        RM_LOG_ERROR("Opening preprocessing store failed: " << path);
+        return false;
+      }
+      elem_bytes = (elem_bytes + 7) / 8 * 8;
+      length = sizeof(store_header) + count * (8 + elem_bytes);
+      struct stat st;
+      bool fresh = fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != length;
+      if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, length) != 0))
+      {
+        close(fd);
+        return false;
+      }
+      void* mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (mem == MAP_FAILED)
+      {
+        RM_LOG_ERROR("Mapping preprocessing store failed: " << path);
+        return false;
+      }
+      base = static_cast<unsigned char*>(mem);
+      store_header* h = header();
+      if (fresh || std::memcmp(h->magic, "RMPREP02", 8) != 0 || h->elem_bytes != elem_bytes
+          || h->first_sid != first || h->count != count)
+      {
+        std::memset(base, 0, length);
+        std::memcpy(h->magic, "RMPREP02", 8);
+        h->elem_bytes = elem_bytes;
+        h->first_sid = first;
+        h->count = count;
+      }
+      return true;
+    }
+
+    bool contains(uint32_t sid) const
+    {
+      return base != nullptr && sid >= header()->first_sid && sid - header()->first_sid < header()->count;
+    }
+
+    // material for sid was generated and not consumed yet
+    bool ready(uint32_t sid) const
+    {
+      return contains(sid) && *status(sid) == ready_record;
+    }
+
+    void put(uint32_t sid, const NTL::ZZ_p& coin)
+    {
+      assert(contains(sid));
+      NTL::BytesFromZZ(elems(sid), NTL::rep(coin), header()->elem_bytes);
+      *status(sid) = ready_record;
+    }
+
+    // hand out sid's material once, under the current ZZ_p modulus
+    bool take(uint32_t sid, NTL::ZZ_p& coin)
+    {
+      if (!ready(sid))
+      {
+        return false;
+      }
+      NTL::conv(coin, NTL::ZZFromBytes(elems(sid), header()->elem_bytes));
+      *status(sid) = used_record;
+      return true;
+    }
+
+    // write the records back to the file
+    void flush()
+    {
+      if (base != nullptr)
+        msync(base, length, MS_SYNC);
+    }
+
+  private:
+    struct store_header
+    {
+      char magic[8];
+      uint64_t elem_bytes;
+      uint64_t first_sid;
+      uint64_t count;
+    };
+
+    static const uint64_t empty_record = 0;
+    static const uint64_t ready_record = 1;
+    static const uint64_t used_record = 2;
+
+    store_header* header() const { return reinterpret_cast<store_header*>(base); }
+
+    uint64_t* status(uint32_t sid) const
+    {
+      uint64_t index = sid - header()->first_sid;
+      return reinterpret_cast<uint64_t*>(base + sizeof(store_header) + index * (8 + header()->elem_bytes));
+    }
+
+    unsigned char* elems(uint32_t sid) const
+    {
+      return reinterpret_cast<unsigned char*>(status(sid) + 1);
+    }
+
+    unsigned char* base = nullptr;
+    uint64_t length = 0;
+};
+
+// One offline round that generates the material of sessions
+// [first_sid, first_sid+count): every server sends each session a random coin
+// contribution to all servers and sums what it receives. The coin is only
+// as unbiased as the last dealer is honest, as nothing commits the dealers
+// before they see the others' contributions.
+class rm_preprocessing_stm
+{
+  public:
+    rm_preprocessing_stm(const rm_info& info, uint32_t first, size_t num_sessions)
+      : first_sid(first), count(num_sessions)
+    {
+      received.resize(info.n, false);
+      coins.SetLength(count);
+    }
+
+    // send every server its part of this server's contributions
+    void deal(rm_client clients[], const rm_info& info)
+    {
+      // the coins of the online phase reseed NTL's generator deterministically
+      std::random_device rd;
+      unsigned char seed[32];
+      for (size_t i = 0 ; i != sizeof(seed) ; i++)
+      {
+        seed[i] = static_cast<unsigned char>(rd());
+      }
+      NTL::SetSeed(seed, sizeof(seed));
+      NTL::vec_ZZ_p part;
+      part.SetLength(count);
+      for (size_t s = 0 ; s != count ; s++)
+      {
+        part[s] = NTL::random_ZZ_p();
+      }
+      for (size_t j = 0 ; j != info.n ; j++)
+      {
+        if (j == info.server_id-1)
+        {
+          add(part, j);
+          continue;
+        }
+        clients[j].send_vector(part, info, first_sid, PREPROCESSING, 1, 1, 1);
+      }
+    }
+
+    void message_handler(rm_net::deserialized_message& dm, const rm_info& info)
+    {
+      if (dm.sender_id == 0 || dm.sender_id > info.n || received[dm.sender_id-1])
+      {
+        return;
+      }
+      if (dm.body.length() != 1 || static_cast<size_t>(dm.body[0].length()) != count)
+      {
+        RM_LOG_WARN("Preprocessing contribution of server " << dm.sender_id << " has the wrong length");
+        return;
+      }
+      add(dm.body[0], dm.sender_id-1);
+    }
+
+    bool completed() const
+    {
+      for (size_t j = 0 ; j != received.size() ; j++)
+      {
+        if (!received[j])
+          return false;
+      }
+      return true;
+    }
+
+    void store(preprocessing_store& out) const
+    {
+      for (size_t s = 0 ; s != count ; s++)
+      {
+        out.put(first_sid + s, coins[s]);
+      }
+      out.flush();
+      rm_metrics().counter("rm_preprocessed_sessions_total", "Sessions whose randomness was generated offline").inc(count);
+    }
+
+    uint32_t first_sid;
+    size_t count;
+
+  private:
+    void add(const NTL::vec_ZZ_p& part, size_t from)
+    {
+      for (size_t s = 0 ; s != count ; s++)
+      {
+        coins[s] += part[s];
+      }
+      received[from] = true;
+    }
+
+    NTL::vec_ZZ_p coins; // sums of all coin contributions
+    std::vector<bool> received;
+};
+
+// Generate the material of every session of runs that the store does not hold
+// yet, one round per stretch of up to max_batch sessions with the same prime.
+// All servers must start from stores holding the same sessions. Messages of
+// the online phase that arrive meanwhile are left in msgs.
+bool preprocess_sessions(
+  preprocessing_store& store,
+  const std::vector<sweep_run>& runs,
+  size_t max_batch,
+  rm_server& server,
+  rm_client clients[],
+  rm_net::async_queue<rm_net::deserialized_message>& msgs)
+{
+  // num_ZZ_p of a contribution is 16 bits wide
+  max_batch = std::max<size_t>(1, std::min<size_t>(max_batch, 32767));
+  std::vector<std::pair<uint32_t,size_t>> batches;
+  for (uint32_t sid = 0 ; sid != runs.size() ; sid++)
+  {
+    if (store.ready(sid))
+    {
+      continue;
+    }
+    if (!batches.empty())
+    {
+      auto& last = batches.back();
+      if (last.first + last.second == sid && last.second < max_batch
+          && runs[last.first].info.fft_prime_info.prime == runs[sid].info.fft_prime_info.prime)
+      {
+        last.second++;
+        continue;
+      }
+    }
+    batches.emplace_back(sid, 1);
+  }
+  // a peer's contribution to a later batch is decoded on receive with that batch's prime
+  for (auto& batch : batches)
+  {
+    server.register_session(batch.first, runs[batch.first].info.fft_prime_info.prime);
+  }
+  std::deque<rm_net::deserialized_message> held;
+  for (auto& batch : batches)
+  {
+    const rm_info& info = runs[batch.first].info;
+    NTL::ZZ_p::init(info.fft_prime_info.prime);
+    RM_LOG_INFO("Generating the coins of sessions " << batch.first << " to " << batch.first + batch.second - 1);
+    rm_preprocessing_stm stm(info, batch.first, batch.second);
+    stm.deal(clients, info);
+    std::deque<rm_net::deserialized_message> pending;
+    pending.swap(held);
+    for (auto& dm : pending)
+    {
+      if (dm.mixing_state_id == PREPROCESSING && dm.sid == stm.first_sid)
+        stm.message_handler(dm, info);
+      else
+        held.push_back(std::move(dm));
+    }
+    while (!stm.completed())
+    {
+      server.update(info, msgs);
+      while (msgs.count() != 0)
+      {
+        auto dm = msgs.pop_front();
+        if (dm.mixing_state_id == PREPROCESSING && dm.sid == stm.first_sid)
+          stm.message_handler(dm, info);
+        else
+          held.push_back(std::move(dm));
+      }
+    }
+    stm.store(store);
+  }
+  for (auto& dm : held)
+  {
+    if (dm.mixing_state_id == PREPROCESSING)
+    {
+      RM_LOG_WARN("Preprocessing contribution for unknown sessions from server " << dm.sender_id);
+      continue;
+    }
+    msgs.push_back(std::move(dm));
+  }
+  return true;
+}
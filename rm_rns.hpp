@@ -0,0 +1,242 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vec_ZZ_p.h>
+#include <assert.h>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "rm_share_matrix.hpp"
+
+// Residue number system over word-size primes. Lane moduli are below 2^50 so
+// that a lane can add up to 2^27 products of two residues in 128 bits before
+// reducing.
+class rns_basis
+{
+  public:
+    static const long modulus_bits = 50;
+
+    // choose enough lanes to represent any sum of max_terms products mod prime exactly
+    void init(const NTL::ZZ& prime, size_t max_terms)
+    {
+      assert(max_terms < (size_t(1) << 27));
+      moduli.clear();
+      crt_coefs.clear();
+      crt_inv.clear();
+      long target_bits = 2*NTL::NumBits(prime) + NTL::NumBits(static_cast<long>(max_terms)) + 1;
+      product = 1;
+      long candidate = (1L << modulus_bits) - 1;
+      while (NTL::NumBits(product) <= target_bits)
+      {
+        while (!NTL::ProbPrime(candidate))
+        {
+          candidate -= 2;
+        }
+        moduli.push_back(candidate);
+        product *= candidate;
+        candidate -= 2;
+      }
+      for (size_t k = 0 ; k != moduli.size() ; k++)
+      {
+        NTL::ZZ partial = product / moduli[k];
+        crt_coefs.push_back(partial);
+        crt_inv.push_back(NTL::InvMod(NTL::rem(partial, moduli[k]), moduli[k]));
+      }
+    }
+
+    size_t lanes() const { return moduli.size(); }
+
+    long modulus(size_t k) const { return moduli[k]; }
+
+    // residue of a little-endian multi-limb integer modulo lane k
+    uint64_t reduce(const uint64_t* limbs, size_t num_limbs, size_t k) const
+    {
+      unsigned __int128 r = 0;
+      for (size_t i = num_limbs ; i != 0 ; i--)
+      {
+        r = ((r << 64) | limbs[i-1]) % static_cast<uint64_t>(moduli[k]);
+      }
+      return static_cast<uint64_t>(r);
+    }
+
+    // Chinese remaindering of one residue per lane (stride apart), reduced into ZZ_p
+    void reconstruct(NTL::ZZ_p& out, const uint64_t* residues, size_t stride) const
+    {
+      NTL::ZZ acc, term;
+      acc = 0;
+      for (size_t k = 0 ; k != moduli.size() ; k++)
+      {
+        long y = NTL::MulMod(static_cast<long>(residues[k*stride]), crt_inv[k], moduli[k]);
+        NTL::mul(term, crt_coefs[k], y);
+        acc += term;
+      }
+      NTL::rem(acc, acc, product);
+      NTL::conv(out, acc);
+    }
+
+  private:
+    std::vector<long> moduli;
+    std::vector<NTL::ZZ> crt_coefs; // product / moduli[k]
+    std::vector<long> crt_inv;      // (product / moduli[k])^-1 mod moduli[k]
+    NTL::ZZ product;
+};
+
+// Client input shares in RNS form, used to compute the decompressed sums of
+// powers lane by lane without materializing the N x N decompressed matrix.
+class rns_power_sums
+{
+  public:
+    void init(const NTL::ZZ& prime, size_t rows, size_t cols)
+    {
+      kill();
+      basis.init(prime, rows);
+      num_rows = rows;
+      num_cols = cols;
+      residues.assign(basis.lanes() * cols * rows, 0);
+      rm_metrics().counter("rm_alloc_bytes_total", "Bytes allocated for session data", "kind=\"rns\"").inc(residues.size() * 8);
+      rm_metrics().gauge("rm_live_bytes", "Bytes of session data currently allocated", "kind=\"rns\"").add(residues.size() * 8);
+    }
+
+    void kill()
+    {
+      rm_metrics().gauge("rm_live_bytes", "Bytes of session data currently allocated", "kind=\"rns\"").add(-static_cast<int64_t>(residues.size() * 8));
+      std::vector<uint64_t>().swap(residues);
+      num_rows = 0;
+      num_cols = 0;
+    }
+
+    size_t lanes() const { return basis.lanes(); }
+
+    // convert one row of the input share matrix into all lanes
+    void load_row(const share_matrix& input, size_t row)
+    {
+      assert(input.cols() == num_cols && row < num_rows);
+      for (size_t j = 0 ; j != num_cols ; j++)
+      {
+        const uint64_t* limbs = input.elem(row, j);
+        for (size_t k = 0 ; k != basis.lanes() ; k++)
+        {
+          lane_column(k, j)[row] = basis.reduce(limbs, input.limbs(), k);
+        }
+      }
+    }
+
+    // zero a row loaded by load_row so that it contributes nothing to the sums
+    void clear_row(size_t row)
+    {
+      assert(row < num_rows);
+      for (size_t k = 0 ; k != basis.lanes() ; k++)
+      {
+        for (size_t j = 0 ; j != num_cols ; j++)
+        {
+          lane_column(k, j)[row] = 0;
+        }
+      }
+    }
+
+    // out[p] = sum over rows of input[a]*input[b] (or input[a] when b < 0) for pairs[p],
+    // with lanes split across num_threads and CRT applied once per power
+    void sums(NTL::vec_ZZ_p& out,
+              const std::vector<std::pair<long,long>>& pairs,
+              size_t num_threads) const
+    {
+      size_t num_lanes = basis.lanes();
+      size_t num_sums = pairs.size();
+      std::vector<uint64_t> lane_sums(num_lanes * num_sums);
+      auto run_lanes = [&](size_t first, size_t last)
+      {
+        for (size_t k = first ; k < last ; k++)
+        {
+          uint64_t m = static_cast<uint64_t>(basis.modulus(k));
+          for (size_t p = 0 ; p != num_sums ; p++)
+          {
+            const uint64_t* ra = lane_column(k, pairs[p].first);
+            unsigned __int128 acc = 0;
+            if (pairs[p].second < 0)
+            {
+              for (size_t i = 0 ; i != num_rows ; i++)
+              {
+                acc += ra[i];
+              }
+            }
+            else
+            {
+              const uint64_t* rb = lane_column(k, pairs[p].second);
+              for (size_t i = 0 ; i != num_rows ; i++)
+              {
+                acc += static_cast<unsigned __int128>(ra[i]) * rb[i];
+              }
+            }
+            lane_sums[p*num_lanes + k] = static_cast<uint64_t>(acc % m);
+          }
+        }
+      };
+      if (num_threads < 1)
+      {
+        num_threads = 1;
+      }
+      std::vector<std::thread> workers;
+      size_t per_thread = (num_lanes + num_threads - 1) / num_threads;
+      for (size_t first = per_thread ; first < num_lanes ; first += per_thread)
+      {
+        workers.emplace_back(run_lanes, first, std::min(first + per_thread, num_lanes));
+      }
+      run_lanes(0, std::min(per_thread, num_lanes));
+      for (auto& w : workers)
+      {
+        w.join();
+      }
+      out.SetLength(num_sums);
+      for (size_t p = 0 ; p != num_sums ; p++)
+      {
+        basis.reconstruct(out[p], lane_sums.data() + p*num_lanes, 1);
+      }
+    }
+
+  private:
+    uint64_t* lane_column(size_t k, size_t col)
+    {
+      return residues.data() + (k*num_cols + col)*num_rows;
+    }
+
+    const uint64_t* lane_column(size_t k, size_t col) const
+    {
+      return residues.data() + (k*num_cols + col)*num_rows;
+    }
+
+    rns_basis basis;
+    size_t num_rows = 0;
+    size_t num_cols = 0;
+    std::vector<uint64_t> residues; // lane-major, then column-major like share_matrix
+};
@@ -41,6 +41,10 @@ class rm_server : public rm_net::server_interface
     rm_server(uint16_t Port): rm_net::server_interface(Port)
     {}
 
+    // a server reached only through in-memory transports
+    rm_server(): rm_net::server_interface()
+    {}
+
   protected:
     virtual bool upon_client_connection(std::shared_ptr<rm_net::connection> client)
     {
@@ -49,7 +53,7 @@ class rm_server : public rm_net::server_interface
 
     virtual void upon_client_disconnection(std::shared_ptr<rm_net::connection> client)
     {
-      std::cout << "Client disconnected\n";
+      RM_LOG_INFO("Client disconnected");
     }
 
     virtual void upon_client_connection(std::shared_ptr<rm_net::connection> client, rm_net::message msg)
@@ -32,6 +32,10 @@
 #include "secretsharing.h"
 #include "additive2basis.h"
 #include "root_finding.h"
+#include "rm_share_matrix.hpp"
+#include "rm_rns.hpp"
+#include "rm_sweep.hpp"
+#include "rm_metrics.hpp"
 
 /* MPC Networking Libraries */
 #include "network_common.hpp"
@@ -44,6 +48,7 @@
 #include "rm_client.hpp"
 #include "rm_server_stm.hpp"
 #include "rm_server.hpp"
+#include "rm_preprocessing.hpp"
 
 /* Standard Libraries */
 #include <assert.h>
@@ -59,14 +64,35 @@
 #include <NTL/vec_ZZ_p.h>
 
 int main(int argc, char *argv[]){
-  if(argc != 4){
-    std::cout << "Configuration Files Required as Follows:" << std::endl;
-    std::cout << "(1) mpc configuration" << std::endl;
-    std::cout << "(2) mix configuration" << std::endl;
-    std::cout << "(3) network configuration" << std::endl;
-    std::cout << "Usage: ./rm_server configs/mix_config configs/mpc_config configs/net_config" << std::endl;
+  std::multimap<std::string,std::string> options;
+  sweep_config sweep;
+  if(argc < 4 || !parse_options(argc, argv, 4, options) || !configure_sweep(sweep, options)){
+    RM_LOG_INFO("Configuration Files Required as Follows:");
+    RM_LOG_INFO("(1) mpc configuration");
+    RM_LOG_INFO("(2) mix configuration");
+    RM_LOG_INFO("(3) network configuration");
+    RM_LOG_INFO("Usage: ./rm_server configs/mix_config configs/mpc_config configs/net_config");
+    RM_LOG_INFO("       [--sweep file] [--case bits:L] [--warmup count] [--reps count] [--results prefix]");
+    RM_LOG_INFO("       [--metrics-file path] [--metrics-port port] [--log-level 0-4] [--io-threads count] [--send-budget bytes] [--speculate 0|1] [--wf-groups count] [--connect-backoff ms:ms]");
+    RM_LOG_INFO("       [--memory-budget bytes] [--spill-dir path] [--huge-pages 0|1]");
+    RM_LOG_INFO("       [--preprocess path prefix] [--preprocess-batch count]");
     return 1;
   }
+  if(options.count("log-level"))
+  {
+    rm_logger::instance().set_level(std::stoi(options.find("log-level")->second));
+  }
+  if(options.count("io-threads"))
+  {
+    rm_net::shared_io_pool().configure(std::stoul(options.find("io-threads")->second));
+  }
+  // bytes each outgoing connection may queue before sends block (0 = unbounded)
+  uint64_t send_budget = options.count("send-budget") ? std::stoull(options.find("send-budget")->second) : 0;
+  // bytes a session may use; larger sessions are streamed or declined (0 = unlimited)
+  uint64_t memory_budget = options.count("memory-budget") ? std::stoull(options.find("memory-budget")->second) : 0;
+  // retry schedule for connecting to peers
+  rm_net::connect_backoff backoff;
+  parse_connect_backoff(options, backoff.initial, backoff.max);
   std::string filename1(argv[1]);
   std::string filename2(argv[2]);
   std::string filename3(argv[3]);
@@ -77,7 +103,7 @@ int main(int argc, char *argv[]){
   fin2.open(filename2);
   fin3.open(filename3);
   if(!fin1.is_open() || !fin2.is_open() || !fin3.is_open() ){
-    std::cout << "Reading configuration file failed" << std::endl;
+    RM_LOG_WARN("Reading configuration file failed");
     return 1;
   }
 
@@ -87,7 +113,7 @@ int main(int argc, char *argv[]){
   /* Prime Modulus Setup */
   fin1 >> read_param;
   if(!fft_prime_from_bit_length(info.fft_prime_info, std::stoi(read_param))){
-    std::cerr << "Prime Length is Invalid" << std::endl;
+    RM_LOG_ERROR("Prime Length is Invalid");
     return 1;
   }
   NTL::ZZ_p::init(info.fft_prime_info.prime);
@@ -117,30 +143,50 @@ int main(int argc, char *argv[]){
   fin2 >> read_param;
   info.L = (size_t) std::stoi(read_param); // Mixing parameter L
   info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed 
-  std::cout << "The number of messages in an epoch: "  << info.N << std::endl;
+  RM_LOG_INFO("The number of messages in an epoch: "  << info.N);
+  if(!read_mix_options(fin2, info.committees)){
+    return 1;
+  }
+  // the id in mpc_config indexes all of net_config; the protocol uses the id within the committee
+  if(info.server_id == 0 || info.server_id > info.n * info.committees){
+    RM_LOG_ERROR("Server ID Is Outside The Committees");
+    return 1;
+  }
+  info.committee = (info.server_id - 1) / info.n;
+  info.server_id = (info.server_id - 1) % info.n + 1;
+  if(info.committees > 1){
+    RM_LOG_INFO("Committee " << info.committee + 1 << " of " << info.committees << ", server " << info.server_id << " of " << info.n);
+  }
 
   /* Network Parameters */
   std::vector<std::string> IPs;
   std::vector<std::string> ports;
+  std::vector<std::string> locals; // unix: or shm: endpoints for co-located parties
   std::string temp_IP;
   std::string temp_port;
-  for(size_t i = 0 ; i != info.n ; i++){
+  for(size_t i = 0 ; i != info.n * info.committees ; i++){
     if (fin3.eof()){
-      cerr << "Incorrect Network Configuration" << endl;
+      RM_LOG_ERROR("Incorrect Network Configuration");
       return 1;
     }
     fin3 >> temp_IP;
     if (fin3.eof()){
-      cerr << "Incorrect Network Configuration" << endl;
+      RM_LOG_ERROR("Incorrect Network Configuration");
       return 1;
     }
     fin3 >> temp_port;
     IPs.push_back(temp_IP);
     ports.push_back(temp_port);
+    locals.push_back(read_local_endpoint(fin3));
   }//
+  // keep the entries of this server's committee
+  size_t first_entry = info.committee * info.n;
+  IPs = std::vector<std::string>(IPs.begin() + first_entry, IPs.begin() + first_entry + info.n);
+  ports = std::vector<std::string>(ports.begin() + first_entry, ports.begin() + first_entry + info.n);
+  locals = std::vector<std::string>(locals.begin() + first_entry, locals.begin() + first_entry + info.n);
 
   for(size_t i = 0 ; i != info.n ; i++){
-    std::cout << "Server[" << i+1 << "]'s IP/Port: " << IPs[i] + "/" + ports[i] << std::endl;
+    RM_LOG_INFO("Server[" << i+1 << "]'s IP/Port: " << IPs[i] + "/" + ports[i] << " " << locals[i]);
   }
 
   // Preprocess of g0 required for root-finding
@@ -151,6 +197,11 @@ int main(int argc, char *argv[]){
 
   // Concurrency parameter and variables
   unsigned int num_threads = 3;
+  info.num_threads = num_threads;
+  info.speculative_decom = !options.count("speculate") || std::stoi(options.find("speculate")->second) != 0;
+  if (options.count("wf-groups")) info.wf_groups = std::stoul(options.find("wf-groups")->second);
+  if (options.count("spill-dir")) info.spill_dir = options.find("spill-dir")->second;
+  if (options.count("huge-pages")) info.huge_page_arena = std::stoi(options.find("huge-pages")->second) != 0;
 
   fin1.close();
   fin2.close();
@@ -159,36 +210,49 @@ int main(int argc, char *argv[]){
 
   // Begin of RM Server Body 
   rm_server server(std::stoi(ports[info.server_id-1]));
+  // slot i of a shared-memory endpoint is server i; slot 0 and the slots after n are for clients
+  if (!locals[info.server_id-1].empty() && !server.listen_local(locals[info.server_id-1], info.n+1))
+  {
+    return 1;
+  }
   server.start();
-  std::cout << "Listening in Port " << ports[info.server_id-1] << std::endl;
+  RM_LOG_INFO("Listening in Port " << ports[info.server_id-1]);
+
+  std::string metrics_file;
+  metrics_http_server metrics_endpoint;
+  if(!configure_metrics(metrics_endpoint, metrics_file, options))
+  {
+    return 1;
+  }
+  metric_gauge& deserialized_depth = rm_metrics().gauge("rm_queue_depth", "Messages waiting in a queue", "queue=\"deserialized\"");
 
   // Each server will be a client to other servers
   rm_client clients[info.n]; 
 
-  // connect to other server
-  for(size_t i = 0 ; i != info.n ;){
+  // connect to all other servers at once
+  auto connect_start = std::chrono::steady_clock::now();
+  rm_net::connect_all(info.n, [&](size_t i) {
     clients[i].local_partyID = info.server_id;
+    clients[i].set_send_budget(send_budget);
     clients[i].remote_partyID = i+1;
     if(i == info.server_id - 1)
     {
-      i++;
-      continue; // skip the client connection if I am the server
+      return true; // skip the client connection if I am the server
     }
-    if (clients[i].connect(IPs[i], ports[i]))
+    // peers on the same host are reached through their local endpoint
+    bool co_located = !locals[i].empty() && IPs[i] == IPs[info.server_id-1];
+    if (co_located ? clients[i].connect_local(locals[i], info.server_id) : clients[i].connect(IPs[i], ports[i]))
     {
-      std::cout << "Server[" << info.server_id << "]: " 
-                << "Connection to Server[" << IPs[i] << " : " << ports[i] << "] established" 
-                << std::endl;
-      i++;
+      RM_LOG_INFO("Server[" << info.server_id << "]: " 
+                << "Connection to Server[" << IPs[i] << " : " << ports[i] << "] established");
+      return true;
     }
-    else{
-      std::cout << "Server[" << info.server_id << "]: " 
-                << "Connection to Server[" << IPs[i] << " : " << ports[i] << "] failed" 
-                << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(2));
-    }
-  }
-  std::cout << "All server connections established\n";
+    RM_LOG_DEBUG("Server[" << info.server_id << "]: " 
+              << "Connection to Server[" << IPs[i] << " : " << ports[i] << "] failed");
+    return false;
+  }, backoff);
+  double connect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - connect_start).count();
+  RM_LOG_INFO("All server connections established in " << connect_ms << " ms");
 
   // move these to a separate class for despute resolution
   std::shared_ptr<std::map<uint32_t,bool>> corrupted_clients(new std::map<uint32_t,bool>);
@@ -217,69 +281,95 @@ int main(int argc, char *argv[]){
   /***********************************************/
   /********* Test Case Generation/Setup **********/
   /***********************************************/
-  size_t prime_idx = 0;
-  size_t L_idx = 0;
-  size_t prime_max_idx = prime_length.size();
-  size_t L_max_idx = L_value.size();
-  std::vector<rm_info> test_cases;
-
-  for(L_idx = 0 ; L_idx != L_max_idx ; L_idx++)
+  std::vector<sweep_run> runs;
+  if(!build_sweep_runs(runs, sweep, info))
   {
-    for(prime_idx = 0 ; prime_idx != prime_max_idx ; prime_idx++)
-    {
-      if(!fft_prime_from_bit_length(info.fft_prime_info, prime_length[prime_idx]))
-      {
-        std::cerr << "Prime Length is Invalid" << std::endl;
-        return 1;
-      }
-      // Mix Parameter Configuration 
-      info.L = L_value[L_idx]; // Mixing parameter L
-      info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed
-      test_cases.emplace_back(info);
-      std::cout << "[Test Case]: Prime Info -> " << test_cases.back().fft_prime_info.two_exponent << ", "
-                                   << test_cases.back().fft_prime_info.odd_factor << ", "
-                                   << test_cases.back().fft_prime_info.zeta << ", "
-                << "# of Msgs -> " << test_cases.back().N << std::endl;
-    }
+    return 1;
   }
 
-  if(!fft_prime_from_bit_length(info.fft_prime_info, test_plen))
+  results_writer results;
+  if(!results.open(sweep.results_prefix, "server" + std::to_string(info.server_id)))
   {
-    std::cerr << "Prime Length is Invalid" << std::endl;
     return 1;
   }
 
-  for(size_t i = 0 ; i != L_value2.size() ; i++)
+  /*******************************/
+  /******* Offline Phase *********/
+  /*******************************/
+  // the well-formedness coin of every session, generated before the first epoch
+  preprocessing_store prep_store;
+  if(options.count("preprocess"))
   {
-    info.L = L_value2[i]; // Mixing parameter L
-    info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed
-    test_cases.emplace_back(info);
-    std::cout << "[Test Case]: Prime Info -> " << test_cases.back().fft_prime_info.two_exponent << ", "
-                                   << test_cases.back().fft_prime_info.odd_factor << ", "
-                                   << test_cases.back().fft_prime_info.zeta << ", "
-                << "# of Msgs -> " << test_cases.back().N << std::endl;
+    size_t elem_bytes = 0;
+    for(size_t i = 0 ; i != runs.size() ; i++){
+      elem_bytes = std::max<size_t>(elem_bytes, NTL::NumBytes(runs[i].info.fft_prime_info.prime));
+    }
+    std::string path = options.find("preprocess")->second + "_server" + std::to_string(info.server_id) + ".bin";
+    size_t batch = options.count("preprocess-batch") ? std::stoul(options.find("preprocess-batch")->second) : 1024;
+    if(!prep_store.open(path, 0, runs.size(), elem_bytes)
+       || !preprocess_sessions(prep_store, runs, batch, server, clients, deserialzed_msgs))
+    {
+      return 1;
+    }
   }
 
+  // outputs of the recent sessions for subscribed clients
+  output_publisher outputs;
+
+  // sessions declined for lack of memory, here or by a peer
+  session_rejections rejections;
+  metric_gauge& planned_peak = rm_metrics().gauge("rm_planned_peak_bytes", "Expected peak memory of the current session");
+
   /*******************************/
   /********* Test Start **********/
   /*******************************/
-  for(size_t case_idx = 0 ; case_idx != test_cases.size() ; case_idx++)
+  for(size_t run_idx = 0 ; run_idx != runs.size() ; run_idx++)
   {
 
   /*******************************/
   /********* Test Setup **********/
   /*******************************/
-  info = test_cases[case_idx];
+  info = runs[run_idx].info;
+  if(rejections.is_rejected(run_idx))
+  {
+    continue; // declined by a peer before this server reached it
+  }
+  memory_plan plan;
+  if(!plan_session_memory(info, memory_budget, plan))
+  {
+    // tell the other servers, then the session's clients once their inputs arrive
+    rejections.reject(run_idx);
+    outputs.drop(run_idx);
+    for(size_t i = 0 ; i != info.n ; i++)
+    {
+      if(i != info.server_id - 1)
+      {
+        clients[i].send_message(session_rejections::rejection(run_idx, info.server_id));
+      }
+    }
+  }
+  else
+  {
+    planned_peak.set(plan.peak());
+  }
 
   NTL::ZZ_p::init(info.fft_prime_info.prime);
+  if(!rejections.is_rejected(run_idx))
+  {
+    server.register_session(run_idx, info.fft_prime_info.prime);
+  }
 
   // initialize
   for(size_t i = 0 ; i != info.N ; i++){
-    corrupted_clients->insert(pair<uint32_t,bool>(i,false));
+    (*corrupted_clients)[i] = false;
   }
   for(size_t i = 0 ; i != info.n ; i++){
-    corrupted_servers->insert(pair<uint32_t,bool>(i,false));
+    (*corrupted_servers)[i] = false;
   } 
+  uint64_t bytes_before = 0;
+  for(size_t i = 0 ; i != info.n ; i++){
+    bytes_before += clients[i].sent_bytes();
+  }
   /*******************************/
   /*******************************/
   /*******************************/
@@ -288,11 +378,52 @@ int main(int argc, char *argv[]){
   while(is_cont)
   {
     server.update(info,deserialzed_msgs);
+    deserialized_depth.set(deserialzed_msgs.count());
     while(deserialzed_msgs.count() != 0)
     {
       // get the first deserialized msg package
-      auto dm = deserialzed_msgs.front();
-      deserialzed_msgs.pop_front();
+      auto dm = deserialzed_msgs.pop_front();
+
+      // subscriptions are served from the published outputs, not by a session
+      if(dm.mixing_state_id == OUTPUT_SUBSCRIBE)
+      {
+        if(!rejections.is_rejected(dm.sid))
+        {
+          outputs.subscribe(dm.sid, dm.conn);
+        }
+        continue;
+      }
+
+      // a peer declined the session, so it can never complete here either
+      if(dm.mixing_state_id == SESSION_REJECTED)
+      {
+        rejections.reject(dm.sid);
+        outputs.drop(dm.sid);
+        if(stms.count(dm.sid))
+        {
+          server.unregister_session(dm.sid);
+          stms.erase(dm.sid);
+        }
+        if(dm.sid == run_idx)
+        {
+          is_cont = false;
+          break;
+        }
+        continue;
+      }
+      if(rejections.is_rejected(dm.sid))
+      {
+        if(dm.mixing_state_id == WAIT_FOR_INPUTS)
+        {
+          rejections.notify(dm.sid, info.server_id, dm.conn);
+          if(dm.sid == run_idx)
+          {
+            is_cont = false; // its client knows; move on to the next session
+            break;
+          }
+        }
+        continue;
+      }
 
       // if stm with sid does not exists;
       if(stms.find(dm.sid) == stms.end()) // If a stm exists for sid
@@ -300,6 +431,13 @@ int main(int argc, char *argv[]){
         //create a new stm with sid
         std::shared_ptr<rm_mixing_stm> stm(new rm_mixing_stm(info,g0));
         stm->sid = dm.sid;
+        stm->round_buffers = &server.round_buffers();
+        stm->outputs = &outputs;
+        NTL::ZZ_p coin;
+        if(prep_store.take(dm.sid, coin))
+        {
+          stm->set_coin(coin);
+        }
         stms.insert(std::pair<uint32_t,std::shared_ptr<rm_mixing_stm>> (dm.sid,stm));
       }
       // execute the stm with dm, clients
@@ -310,7 +448,31 @@ int main(int argc, char *argv[]){
                                       corrupted_servers);
       if(stms.at(dm.sid)->get_state() == 15)
       {
+        if(!runs[run_idx].warmup)
+        {
+          uint64_t bytes_after = 0;
+          for(size_t i = 0 ; i != info.n ; i++){
+            bytes_after += clients[i].sent_bytes();
+          }
+          results.write_server(dm.sid, runs[run_idx], stms.at(dm.sid)->timings, bytes_after - bytes_before);
+        }
+        server.unregister_session(dm.sid); // before its buffers are freed
         stms.erase(dm.sid); // remove the completed stm.
+        for(auto& s : server.stats())
+        {
+          RM_LOG_DEBUG(s);
+        }
+        for(size_t i = 0 ; i != info.n ; i++)
+        {
+          if(i != info.server_id - 1)
+          {
+            RM_LOG_DEBUG(clients[i].stats());
+          }
+        }
+        if(!metrics_file.empty())
+        {
+          rm_metrics().write_file(metrics_file);
+        }
         //the followings are only for testing
         //std::cout << "Server terminated\n";
         is_cont = false; 
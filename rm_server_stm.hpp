@@ -33,6 +33,8 @@
 #include <NTL/vec_ZZ_p.h>
 #include <vector>
 #include <bits/stdc++.h> 
+#include "rm_output.hpp"
+#include "rm_memory_planner.hpp"
 
 using namespace std;
 using namespace NTL;
@@ -54,8 +56,15 @@ enum mix_state {
   BATCHED_OPEN_SUMS_OF_POWERS_8, // wait for msgs (round 4)
   COMPUTE_NEWTON_ID_AND_FIND_ROOTS, 
   COMPLETED,
+  PREPROCESSING, // offline generation of session randomness (rm_preprocessing.hpp)
+  OUTPUT_SUBSCRIBE, // output delivery (rm_output.hpp)
+  OUTPUT_CHUNK,
+  SESSION_REJECTED, // a server declined the session (rm_memory_planner.hpp)
   NUMBER_OF_STATES
 };
+static_assert(OUTPUT_SUBSCRIBE == output_subscribe_state && OUTPUT_CHUNK == output_chunk_state,
+              "output delivery states out of sync");
+static_assert(SESSION_REJECTED == session_rejected_state, "session rejection state out of sync");
 
 class rm_mixing_stm{
   public:
@@ -63,6 +72,8 @@ class rm_mixing_stm{
     rm_mixing_stm(const rm_info& _info,
                   NTL::ZZ_pX poly_from_xvals);
 
+    ~rm_mixing_stm();
+
     // return state
     mix_state get_state()
     {
@@ -93,6 +104,17 @@ class rm_mixing_stm{
 
     void compute_wellformedness_pred(const rm_info& info);
 
+    // Optimistic well-formedness check: preds holds one random linear
+    // combination of the client predicates per group in wf_open_groups. Groups
+    // that open to non-zero are split in halves and opened again, down to
+    // single clients.
+    void aggregate_wf_groups(const rm_info& info);
+
+    // the groups of an opened pass that need another pass; single clients are marked corrupted
+    void split_wf_groups(
+        const NTL::vec_ZZ_p& opened,
+        std::shared_ptr<std::map<uint32_t,bool>> corr_clients);
+
     // Batch open: expand shares and send i-th expanded share to i-th server
     void batched_open_expand_send(
         rm_client clients[],
@@ -111,6 +133,20 @@ class rm_mixing_stm{
         size_t num_blocks,
         size_t rd);
 
+    // With l = 1 the expansion is a column of ones, so round 1 already gives
+    // every server all n shares of every value. The values are then decoded
+    // locally and the return round is skipped.
+    bool opens_in_one_round(const rm_info& info) const
+    {
+      return info.l == 1;
+    }
+
+    // RS-decode each block of shares received in round 1 (0 where decoding fails)
+    void decode_received_shares(
+        NTL::vec_ZZ_p& opened,
+        const rm_info& info,
+        size_t num_blocks);
+
     // Batch open: reconstuct all batched shares
     void reconstruct_batched_shares(
         vec_ZZ_p& output_secrets,
@@ -119,7 +155,7 @@ class rm_mixing_stm{
         size_t num_blocks,
         size_t last_size);
 
-    // deompress valid client inputs
+    // deompress valid client inputs (summed row by row with info.streaming_sums)
     void decompress_input_encodings(
         const rm_info& info,
         std::shared_ptr<std::map<uint32_t,bool>> corr_clients);
@@ -131,6 +167,44 @@ class rm_mixing_stm{
 
     // compute the sums of powers for all powers
     void compute_sums_of_powers(const rm_info& info);
+
+    // convert valid client inputs into RNS lanes (replaces decompression in rns_mode)
+    void load_rns_inputs(
+        const rm_info& info,
+        std::shared_ptr<std::map<uint32_t,bool>> corr_clients);
+
+    // compute the sums of powers lane by lane and reconstruct them via CRT
+    void compute_rns_sums_of_powers(const rm_info& info);
+
+    // Speculative decompression: a worker decompresses each client input as
+    // it arrives and adds it to running sums of powers (or loads it into the
+    // RNS lanes), while later inputs and the predicate rounds are in flight.
+    void start_speculation(const rm_info& info);
+    void speculate_row(size_t row);
+    bool speculated(size_t row);
+    void cancel_speculation();
+    void speculation_worker(rm_info info, NTL::ZZ_pContext context);
+
+    // wait for the worker and take out the clients found corrupted; false if
+    // the inputs must be decompressed from scratch instead
+    bool finish_speculation(
+        const rm_info& info,
+        std::shared_ptr<std::map<uint32_t,bool>> corr_clients);
+
+    // add a stage's compute time to the metrics registry
+    void record_stage(const char* stage, double ms);
+
+    // add the wait time of network round rd (1-4) to the metrics registry
+    void record_round_wait(size_t rd);
+
+    // add the latency of a peer's round-rd message to the metrics registry
+    void record_peer_arrival(size_t rd, const rm_net::deserialized_message& dm);
+
+    // let the peers' round-rd payloads be decoded straight into column j of dest
+    void register_round_buffers(NTL::vec_vec_ZZ_p& dest, size_t rd, size_t num_blocks, const rm_info& info);
+
+    // withdraw what register_round_buffers left for the round waited for in state
+    void release_round_buffers(uint16_t state);
   
   public:
     uint32_t sid; // session id unique up to each stm
@@ -138,6 +212,12 @@ class rm_mixing_stm{
     std::chrono::steady_clock::time_point e2e_end_tick;
     std::chrono::steady_clock::time_point wf_start_tick;
     std::chrono::steady_clock::time_point wf_end_tick;
+    std::chrono::steady_clock::time_point round_start_tick; // when the current network round started waiting
+    stage_timings timings; // stage timings of this session
+    std::vector<metric_histogram*> peer_round_histograms; // by round, then peer; registered once per session
+    size_t num_servers = 0; // info.n, the stride of peer_round_histograms
+    rm_net::receive_buffers* round_buffers = nullptr; // the server's receive buffers, if payloads may be decoded in place
+    output_publisher* outputs = nullptr; // where the mixed messages go, if anyone subscribes
 
   private:
     mix_state stm_state; // current mixing state
@@ -148,19 +228,38 @@ class rm_mixing_stm{
     NTL::ZZ_pX g0;  // polynomial from x values as its roots
     NTL::ZZ_p ver_coin_seed; // a random coin seed for well-formedness verification
     NTL::ZZ_p deg_2t_zero_shares; // degree 2t zero shares used to open 2t shares
-    NTL::vec_vec_ZZ_p client_input;
+    session_arena arena; // storage of the matrices below, released at COMPLETED
+    share_matrix client_input; // client i's encoding share j at (i, j)
     NTL::vec_ZZ_p preds; // input well-formedness predicates
-    NTL::vec_vec_ZZ_p decompressed;
+    share_matrix decompressed; // client i's share of power p at (i, p)
+    rns_power_sums rns_inputs; // client inputs in RNS lanes (rns_mode only)
     NTL::vec_ZZ_p shared_sums_of_powers;
     NTL::vec_vec_ZZ_p rec_exp_shares1; // a container to store expanded shares of WF preds
     NTL::vec_vec_ZZ_p ret_open_exp_shares1; // stores opennings of expanded shares returned from other servers
     NTL::vec_vec_ZZ_p rec_exp_shares2; // a container to store expanded shares of sums of powers
     NTL::vec_vec_ZZ_p ret_open_exp_shares2; // store opennings of expanded shares returned from other servers
+    NTL::vec_ZZ_p opened_values; // values decoded locally after round 1 or 3 (l = 1)
     size_t client_msg_counter; 
     size_t num_blocks1;
     size_t size_last1;
+    size_t wf_blocks; // blocks of the current well-formedness open
+    size_t wf_size_last;
+    NTL::vec_ZZ_p client_preds; // per-client predicates behind the group combinations
+    std::vector<std::pair<size_t,size_t>> wf_open_groups; // [first, last) clients of each opened combination
+    size_t wf_level = 0; // well-formedness passes done so far; sent as the block index of rounds 1 and 2
+    std::deque<rm_net::deserialized_message> wf_pending; // peers' round 1 messages of a later pass
     NTL::ZZ_p zero;
-    std::map<uint32_t,std::shared_ptr<rm_net::connection>> rm_client_connections; // a vector to store all connections to rm clients
+    std::set<std::shared_ptr<rm_net::connection>> rm_client_connections; // every connection a client input arrived on
+
+    // speculative decompression state, guarded by spec_mtx
+    std::thread spec_thread;
+    std::mutex spec_mtx;
+    std::condition_variable spec_cv;
+    std::deque<size_t> spec_rows; // loaded rows the worker has not taken yet
+    bool spec_closed = false; // no more rows will be queued
+    bool spec_valid = false; // the worker saw every row exactly as it stands
+    std::vector<bool> spec_queued; // rows handed to the worker
+    NTL::vec_ZZ_p spec_sums; // running sums of powers (native mode)
 };
 
 rm_mixing_stm::rm_mixing_stm(
@@ -172,6 +271,15 @@ rm_mixing_stm::rm_mixing_stm(
   {
     msg_reception_status[i].resize(info.n, false);
   }
+  num_servers = info.n;
+  for (size_t rd = 1 ; rd <= 4 ; rd++)
+  {
+    for (size_t peer = 1 ; peer <= info.n ; peer++)
+    {
+      std::string labels = "round=\"" + std::to_string(rd) + "\",peer=\"" + std::to_string(peer) + "\"";
+      peer_round_histograms.push_back(&rm_metrics().histogram("rm_peer_round_ms", "Time from sending a round to receiving a peer's message", labels));
+    }
+  }
   len_input_encoding = 7*info.L+5;
   batched_block_size = info.n - (2*info.t + 1);
   xvals = gen_xvals(info.n);
@@ -184,36 +292,123 @@ rm_mixing_stm::rm_mixing_stm(
   {
     num_blocks1++;
   }
-  decompressed.SetLength(info.N);
+  wf_blocks = num_blocks1;
+  wf_size_last = size_last1;
   // set up spaces for shares for batched opens
   rec_exp_shares1.SetLength(num_blocks1);
-  ret_open_exp_shares1.SetLength(num_blocks1); 
-  ret_open_exp_shares2.SetLength(num_blocks1); 
   for(size_t i = 0 ; i != num_blocks1 ; i++) 
   { // for each block, we expect n shares
     rec_exp_shares1[i].SetLength(info.n);
-    ret_open_exp_shares1[i].SetLength(info.n);
-    ret_open_exp_shares2[i].SetLength(info.n);
+  }
+  if (!opens_in_one_round(info)) // the return rounds are skipped otherwise
+  {
+    ret_open_exp_shares1.SetLength(num_blocks1); 
+    ret_open_exp_shares2.SetLength(num_blocks1); 
+    for(size_t i = 0 ; i != num_blocks1 ; i++) 
+    {
+      ret_open_exp_shares1[i].SetLength(info.n);
+      ret_open_exp_shares2[i].SetLength(info.n);
+    }
   }
   zero = 0;
 }
 
+rm_mixing_stm::~rm_mixing_stm()
+{
+  {
+    std::scoped_lock lock(spec_mtx);
+    spec_closed = true;
+  }
+  spec_cv.notify_all();
+  if (spec_thread.joinable())
+  {
+    spec_thread.join();
+  }
+}
+
 void rm_mixing_stm::compute_wellformedness_pred(const rm_info& info){
   size_t encoding_size = 7*info.L+5;
-  vec_vec_ZZ_p coins;
-  coins.SetLength(info.N);
-  for(size_t i = 0 ; i != info.N; i++)
+  // a tile of inputs at a time; each client's coins are drawn just before its
+  // predicate, in the same order as drawing all coins first
+  size_t tile = client_input.tile_rows();
+  vec_vec_ZZ_p input_rows;
+  vec_ZZ_p coins;
+  for (size_t first = 0 ; first < info.N ; first += tile){
+    size_t count = std::min(tile, info.N - first);
+    client_input.get_rows(input_rows, first, count);
+    for (size_t r = 0 ; r != count ; r++){
+      size_t i = first + r;
+      coins.kill();
+      for(size_t j = 0 ; j != encoding_size-1 ; j++)
+      {
+        ver_coin_seed = ver_coin_seed + (encoding_size-1 + i) + j;
+        NTL::SetSeed(NTL::rep(ver_coin_seed));
+        coins.append(NTL::to_ZZ_p(NTL::RandomBits_ZZ(NumBits(info.fft_prime_info.prime)*2)));
+      }
+      preds.append(verify_format(coins, input_rows[r], info.L));
+    }
+    client_input.release_rows(first, count);
+  }
+  if (info.wf_groups != 0)
+  {
+    client_preds.swap(preds);
+    size_t groups = std::min(info.wf_groups, info.N);
+    wf_open_groups.clear();
+    for (size_t g = 0 ; g != groups ; g++)
+    {
+      wf_open_groups.emplace_back(g*info.N/groups, (g+1)*info.N/groups);
+    }
+    aggregate_wf_groups(info);
+  }
+}
+
+void rm_mixing_stm::aggregate_wf_groups(const rm_info& info)
+{
+  // fresh coefficients for every pass, drawn from the common coin like the predicate coins
+  NTL::SetSeed(NTL::rep(ver_coin_seed) + info.N + wf_level);
+  long bits = NumBits(info.fft_prime_info.prime)*2;
+  preds.kill();
+  for (size_t g = 0 ; g != wf_open_groups.size() ; g++)
   {
-    for(size_t j = 0 ; j != encoding_size-1 ; j++)
+    NTL::ZZ_p acc;
+    for (size_t i = wf_open_groups[g].first ; i != wf_open_groups[g].second ; i++)
     {
-      ver_coin_seed = ver_coin_seed + (encoding_size-1 + i) + j;
-      NTL::SetSeed(NTL::rep(ver_coin_seed));
-      coins[i].append(NTL::to_ZZ_p(NTL::RandomBits_ZZ(NumBits(info.fft_prime_info.prime)*2)));
+      acc += NTL::to_ZZ_p(NTL::RandomBits_ZZ(bits)) * client_preds[i];
     }
+    preds.append(acc);
   }
-  for (size_t i = 0 ; i != info.N ; i++){
-    preds.append(verify_format(coins[i], client_input[i], info.L));
+  // pad with public zeros to whole blocks
+  while (preds.length() % info.l != 0)
+  {
+    preds.append(zero);
   }
+  wf_blocks = preds.length()/info.l;
+  wf_size_last = 0;
+}
+
+void rm_mixing_stm::split_wf_groups(
+  const NTL::vec_ZZ_p& opened,
+  std::shared_ptr<std::map<uint32_t,bool>> corr_clients)
+{
+  std::vector<std::pair<size_t,size_t>> next;
+  for (size_t g = 0 ; g != wf_open_groups.size() ; g++)
+  {
+    if (opened[g] == 0)
+    {
+      continue; // every client of the group is well-formed, except with probability 1/p
+    }
+    size_t first = wf_open_groups[g].first;
+    size_t last = wf_open_groups[g].second;
+    if (last - first == 1)
+    {
+      corr_clients->at(static_cast<uint32_t>(first)) = true;
+      continue;
+    }
+    size_t mid = first + (last - first)/2;
+    next.emplace_back(first, mid);
+    next.emplace_back(mid, last);
+  }
+  wf_open_groups.swap(next);
 }
 
 // a helper function to convert a subvector of length n to a matrix of n by 1
@@ -231,7 +426,7 @@ void spread_block(vec_vec_ZZ_p& out, vec_ZZ_p& input, size_t n)
 {
   if(out.length() != input.length() || input.length() != n)
   {
-    std::cout << "STM ERROR: Expanded Mismatching with The number of Servers\n";
+    RM_LOG_ERROR("STM ERROR: Expanded Mismatching with The number of Servers");
     return;
   }
   for(size_t i = 0 ; i != n ; i++)
@@ -287,7 +482,7 @@ void rm_mixing_stm::batched_open_expand_send(
       msg_reception_status[rd-1][info.server_id-1] = true;
       continue;
     }
-    clients[i].send_vector(expanded_shares[i], info, sid, stm_state+1, 1, 1, 1);
+    clients[i].send_vector(expanded_shares[i], info, sid, stm_state+1, rd <= 2 ? wf_level+1 : 1, 1, 1);
   }
 }
 
@@ -298,26 +493,9 @@ void rm_mixing_stm::open_exp_shares_to_all(
   size_t num_blocks,      // number of blocks
   size_t rd)              // round > 0
 {
-  size_t cnt = 0;
-  NTL::vec_ZZ_p temp, errors, opened_shares;
-  bool test;
+  NTL::vec_ZZ_p opened_shares;
 
-  for(size_t i = 0 ; i != num_blocks ; i++)
-  {
-    assert(rec_exp_shares1[i].length() == info.n);
-    test = rs_decode(temp, errors, xvals, rec_exp_shares1[i], g0, 2*info.t, 1);
-    if(test) // if opening succeeded, then add the shares to opened_shares
-    {
-      opened_shares.append(temp[0]);
-    }
-    else
-    {
-      std::cout << "[Open Expended Shares To All]: RS DECODE FAILED" << "\n";
-      opened_shares.append(zero); // otherwise, set it to 0
-    }
-    temp.kill();
-    errors.kill();
-  }
+  decode_received_shares(opened_shares, info, num_blocks);
 
   for (size_t i = 0 ; i != info.n ; i++)
   {
@@ -331,11 +509,38 @@ void rm_mixing_stm::open_exp_shares_to_all(
       continue;
     }
     if(clients[i].is_connected()){
-      clients[i].send_vector(opened_shares, info, sid, stm_state+1, 1, 1, 1);
+      clients[i].send_vector(opened_shares, info, sid, stm_state+1, rd <= 2 ? wf_level+1 : 1, 1, 1);
     }
   }
 }
 
+void rm_mixing_stm::decode_received_shares(
+  NTL::vec_ZZ_p& opened,
+  const rm_info& info,
+  size_t num_blocks)
+{
+  NTL::vec_ZZ_p temp, errors;
+  bool test;
+
+  opened.kill();
+  for(size_t i = 0 ; i != num_blocks ; i++)
+  {
+    assert(static_cast<size_t>(rec_exp_shares1[i].length()) == info.n);
+    test = rs_decode(temp, errors, xvals, rec_exp_shares1[i], g0, 2*info.t, 1);
+    if(test) // if opening succeeded, then add the shares to opened
+    {
+      opened.append(temp[0]);
+    }
+    else
+    {
+      RM_LOG_WARN("[Open Expended Shares To All]: RS DECODE FAILED");
+      opened.append(zero); // otherwise, set it to 0
+    }
+    temp.kill();
+    errors.kill();
+  }
+}
+
 /*
 bool is_all_true(std::vector<bool> rec_status_vec)
 {
@@ -382,17 +587,41 @@ void rm_mixing_stm::decompress_input_encodings(
   const rm_info& info,
   std::shared_ptr<std::map<uint32_t,bool>> corr_clients)
 {
-  for(size_t i = 0 ; i != info.N ; i++){
-    assert(decompressed[i].length()==0);
-    assert(client_input[i].length()==len_input_encoding);
-    if (corr_clients->at(static_cast<uint32_t>(i))){
-      decompressed[i].SetLength(info.N); // set to be all zero's
-    }
-    else{
-      decompressed[i] = opt_decompress_encoding(client_input[i],info.L);
+  assert(client_input.rows()==info.N && client_input.cols()==len_input_encoding);
+  if (info.streaming_sums)
+  {
+    spec_sums.SetLength(info.N); // all zero's; taken as the sums like the speculative ones
+  }
+  else
+  {
+    decompressed.set_dims(info.N, info.N, info.fft_prime_info.prime, info.huge_page_arena ? &arena : nullptr); // all zero's
+  }
+  size_t tile = client_input.tile_rows();
+  vec_vec_ZZ_p input_rows;
+  vec_ZZ_p output_row;
+  for(size_t first = 0 ; first < info.N ; first += tile){
+    size_t count = std::min(tile, info.N - first);
+    client_input.get_rows(input_rows, first, count);
+    for(size_t r = 0 ; r != count ; r++){
+      size_t i = first + r;
+      if (corr_clients->at(static_cast<uint32_t>(i))){
+        continue; // leave the row of a corrupted client zero
+      }
+      output_row = opt_decompress_encoding(input_rows[r],info.L);
+      assert(static_cast<size_t>(output_row.length()) == info.N);
+      if (info.streaming_sums)
+      {
+        for (size_t p = 0 ; p != info.N ; p++)
+        {
+          spec_sums[p] += output_row[p];
+        }
+      }
+      else
+      {
+        decompressed.set_row(i, output_row);
+      }
     }
-    assert(decompressed[i].length()==info.N);
-    client_input[i].kill();
+    client_input.release_rows(first, count);
   }
   client_input.kill();
 }
@@ -401,9 +630,7 @@ void rm_mixing_stm::compute_sum_of_powers(
   size_t p, 
   const rm_info& info)
 {
-  for(size_t i = 0 ; i != info.N ; i++){
-    shared_sums_of_powers[p] += decompressed[i][p];
-  }
+  decompressed.column_sum(shared_sums_of_powers[p], p);
   //shared_sums_of_powers[p] += zero_share_2d;
 }
 
@@ -412,6 +639,243 @@ void rm_mixing_stm::compute_sums_of_powers(const rm_info& info){
   for(size_t i = 0 ; i != info.N ; i++){
     compute_sum_of_powers(i, info);
   }
+  decompressed.kill();
+}
+
+void rm_mixing_stm::load_rns_inputs(
+  const rm_info& info,
+  std::shared_ptr<std::map<uint32_t,bool>> corr_clients)
+{
+  assert(client_input.rows()==info.N && client_input.cols()==len_input_encoding);
+  rns_inputs.init(info.fft_prime_info.prime, info.N, len_input_encoding); // all zero's
+  size_t tile = client_input.tile_rows();
+  for(size_t first = 0 ; first < info.N ; first += tile){
+    size_t count = std::min(tile, info.N - first);
+    for(size_t i = first ; i != first + count ; i++){
+      if (corr_clients->at(static_cast<uint32_t>(i))){
+        continue; // a corrupted client contributes nothing to the sums
+      }
+      rns_inputs.load_row(client_input, i);
+    }
+    client_input.release_rows(first, count);
+  }
+  client_input.kill();
+}
+
+void rm_mixing_stm::compute_rns_sums_of_powers(const rm_info& info){
+  rns_inputs.sums(shared_sums_of_powers, decompress_encoding_pairs(info.L), info.num_threads);
+  assert(static_cast<size_t>(shared_sums_of_powers.length()) == info.N);
+  rns_inputs.kill();
+}
+
+void rm_mixing_stm::start_speculation(const rm_info& info)
+{
+  spec_valid = true;
+  spec_queued.assign(info.N, false);
+  if (info.rns_mode)
+  {
+    rns_inputs.init(info.fft_prime_info.prime, info.N, len_input_encoding); // all zero's
+  }
+  else
+  {
+    spec_sums.SetLength(info.N); // all zero's
+  }
+  NTL::ZZ_pContext context;
+  context.save();
+  spec_thread = std::thread(&rm_mixing_stm::speculation_worker, this, info, context);
+}
+
+void rm_mixing_stm::speculate_row(size_t row)
+{
+  {
+    std::scoped_lock lock(spec_mtx);
+    assert(!spec_queued[row]);
+    spec_queued[row] = true;
+    spec_rows.push_back(row);
+  }
+  spec_cv.notify_one();
+}
+
+// row was handed to the worker before
+bool rm_mixing_stm::speculated(size_t row)
+{
+  std::scoped_lock lock(spec_mtx);
+  return spec_queued[row];
+}
+
+// stop the worker and discard what it summed; the inputs are then
+// decompressed from scratch by finish_speculation's caller
+void rm_mixing_stm::cancel_speculation()
+{
+  {
+    std::scoped_lock lock(spec_mtx);
+    spec_valid = false;
+    spec_closed = true;
+  }
+  spec_cv.notify_all();
+  spec_thread.join();
+  rns_inputs.kill();
+  spec_sums.kill();
+  RM_LOG_DEBUG("Speculative decompression cancelled for session " << sid);
+}
+
+void rm_mixing_stm::speculation_worker(rm_info info, NTL::ZZ_pContext context)
+{
+  context.restore(); // the ZZ_p modulus is per thread
+  vec_ZZ_p input_row, output_row;
+  while (true)
+  {
+    size_t row;
+    {
+      std::unique_lock<std::mutex> lock(spec_mtx);
+      spec_cv.wait(lock, [this]() { return !spec_rows.empty() || spec_closed; });
+      if (spec_rows.empty())
+      {
+        return;
+      }
+      row = spec_rows.front();
+      spec_rows.pop_front();
+    }
+    // other rows of client_input may be written meanwhile; this one is not
+    if (info.rns_mode)
+    {
+      rns_inputs.load_row(client_input, row);
+    }
+    else
+    {
+      client_input.get_row(input_row, row);
+      output_row = opt_decompress_encoding(input_row, info.L);
+      for (size_t p = 0 ; p != info.N ; p++)
+      {
+        spec_sums[p] += output_row[p];
+      }
+    }
+  }
+}
+
+bool rm_mixing_stm::finish_speculation(
+  const rm_info& info,
+  std::shared_ptr<std::map<uint32_t,bool>> corr_clients)
+{
+  if (!spec_thread.joinable())
+  {
+    return false;
+  }
+  {
+    std::scoped_lock lock(spec_mtx);
+    spec_closed = true;
+  }
+  spec_cv.notify_all();
+  spec_thread.join();
+  if (!spec_valid)
+  {
+    RM_LOG_DEBUG("Speculative decompression discarded for session " << sid);
+    rns_inputs.kill();
+    spec_sums.kill();
+    return false;
+  }
+  vec_ZZ_p input_row, output_row;
+  for (size_t i = 0 ; i != info.N ; i++)
+  {
+    if (!spec_queued[i] || !corr_clients->at(static_cast<uint32_t>(i)))
+    {
+      continue;
+    }
+    // a corrupted client contributes nothing to the sums
+    if (info.rns_mode)
+    {
+      rns_inputs.clear_row(i);
+    }
+    else
+    {
+      client_input.get_row(input_row, i);
+      output_row = opt_decompress_encoding(input_row, info.L);
+      for (size_t p = 0 ; p != info.N ; p++)
+      {
+        spec_sums[p] -= output_row[p];
+      }
+    }
+  }
+  client_input.kill();
+  return true;
+}
+
+void rm_mixing_stm::record_stage(const char* stage, double ms)
+{
+  static const char* const stages[] = {"COMWF", "E2EWF", "DECOM", "SOPOW", "NEWID", "ROOTF", "RME2E"};
+  static const std::vector<metric_histogram*> histograms = []()
+  {
+    std::vector<metric_histogram*> h;
+    for (const char* name : stages)
+    {
+      h.push_back(&rm_metrics().histogram("rm_stage_ms", "Compute time of a mixing stage", std::string("stage=\"") + name + "\""));
+    }
+    return h;
+  }();
+  for (size_t i = 0 ; i != histograms.size() ; i++)
+  {
+    if (std::strcmp(stages[i], stage) == 0)
+    {
+      histograms[i]->observe(ms);
+      return;
+    }
+  }
+  assert(false);
+}
+
+void rm_mixing_stm::record_round_wait(size_t rd)
+{
+  static const std::vector<metric_histogram*> histograms = []()
+  {
+    std::vector<metric_histogram*> h;
+    for (size_t r = 1 ; r <= 4 ; r++)
+    {
+      h.push_back(&rm_metrics().histogram("rm_round_wait_ms", "Time waiting for all peers in a batched open round", "round=\"" + std::to_string(r) + "\""));
+    }
+    return h;
+  }();
+  histograms[rd-1]->observe(timings.round_wait[rd-1]);
+}
+
+void rm_mixing_stm::record_peer_arrival(size_t rd, const rm_net::deserialized_message& dm)
+{
+  // a message that arrives before this server has sent its own has no latency to record
+  if (stm_state != dm.mixing_state_id)
+  {
+    return;
+  }
+  double ms = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - round_start_tick).count();
+  peer_round_histograms[(rd-1) * num_servers + dm.sender_id-1]->observe(ms);
+}
+
+void rm_mixing_stm::register_round_buffers(NTL::vec_vec_ZZ_p& dest, size_t rd, size_t num_blocks, const rm_info& info)
+{
+  if (round_buffers == nullptr)
+  {
+    return;
+  }
+  for (size_t j = 0 ; j != info.n ; j++)
+  {
+    // our own column is stored locally, and a peer already received went through the queue
+    if (j == info.server_id-1 || msg_reception_status[rd-1][j])
+    {
+      continue;
+    }
+    std::vector<NTL::ZZ_p*> elems(num_blocks);
+    for (size_t i = 0 ; i != num_blocks ; i++)
+    {
+      elems[i] = &dest[i][j];
+    }
+    round_buffers->add(sid, stm_state+1, rd <= 2 ? wf_level+1 : 1, j+1, std::move(elems));
+  }
+}
+
+void rm_mixing_stm::release_round_buffers(uint16_t state)
+{
+  if (round_buffers != nullptr)
+  {
+    round_buffers->remove_round(sid, state);
+  }
 }
 
 void rm_mixing_stm::message_handler(
@@ -425,53 +889,78 @@ void rm_mixing_stm::message_handler(
       if(client_msg_counter == 0)
       {
         //std::cout << "MSG HANDLER: The first client message is received. Memroy allocated.\n";
-        client_input.SetLength(info.N);
-        rm_client_connections.insert({dm.sender_id, dm.conn});
-        rm_client_connections.find(dm.sender_id)->second->local_partyID = info.server_id;
-        rm_client_connections.find(dm.sender_id)->second->remote_partyID = dm.sender_id;
+        std::string spill_path = info.spill_dir + "/rm_inputs_server" + std::to_string(info.server_id) + "_sid" + std::to_string(sid) + ".bin";
+        if (info.spill_dir.empty() || !client_input.map_file(info.N, len_input_encoding, info.fft_prime_info.prime, spill_path))
+        {
+          if (!info.spill_dir.empty())
+          {
+            RM_LOG_WARN("Mapping " << spill_path << " failed; client inputs are kept in memory");
+          }
+          client_input.set_dims(info.N, len_input_encoding, info.fft_prime_info.prime, info.huge_page_arena ? &arena : nullptr);
+        }
+        if (info.speculative_decom && !spec_thread.joinable())
+        {
+          start_speculation(info);
+        }
       }
-      if (dm.body[0].length() != 7*info.L+5)
+      if (dm.conn)
       {
-        std::cout << "MSG HANDLER: Deserialized Input Is Incorrectly Received\n";
+        rm_client_connections.insert(dm.conn); // inputs may come over many connections
+      }
+      size_t nbytes = NTL::NumBytes(info.fft_prime_info.prime);
+      assert(client_input.rows() == info.N);
+      if (dm.num_ZZ_p != len_input_encoding || dm.raw.size() != len_input_encoding*nbytes || dm.sender_id >= info.N)
+      {
+        RM_LOG_WARN("MSG HANDLER: Deserialized Input Is Incorrectly Received");
         // TODO: add this client to the corrupted client list
       }
-      assert(client_input.length() == info.N);
-      client_input[dm.sender_id].SetLength(7*info.L+5);
-      client_input[dm.sender_id] = dm.body[0];
-      client_msg_counter++;
-
-      /*
-      if(rm_client_connections.find(dm.sender_id) == rm_client_connections.end())
+      else
       {
-        rm_client_connections.insert({dm.sender_id, dm.conn});
+        if (spec_thread.joinable() && speculated(dm.sender_id))
+        {
+          cancel_speculation(); // the worker may still be reading the row being resubmitted
+        }
+        client_input.load_from_wire(dm.sender_id, dm.raw.data(), dm.num_ZZ_p, nbytes);
+        if (spec_thread.joinable())
+        {
+          speculate_row(dm.sender_id);
+        }
       }
-      */
+      client_msg_counter++;
+
       break;
     }
     case BATCHED_OPEN_WF_PREDICATES_2: // [rount 1] wait
     {
-      if (msg_reception_status[0][dm.sender_id-1]) // TODO: map dm.sender_id to a x-value
+      if (dm.block_idx > wf_level+1)
+      {
+        wf_pending.push_back(std::move(dm)); // a peer already started the next pass
+        break;
+      }
+      if (dm.block_idx != wf_level+1 || msg_reception_status[0].empty() || msg_reception_status[0][dm.sender_id-1]) // TODO: map dm.sender_id to a x-value
       {
         break; // we will ingonre the current dm message
       }
-      for(size_t i = 0 ; i != num_blocks1 ; i++)
+      for(size_t i = 0 ; !dm.in_place && i != wf_blocks ; i++)
       {
         rec_exp_shares1[i][dm.sender_id-1] = dm.body[0][i];
       }
       msg_reception_status[0][dm.sender_id-1] = true;
+      record_peer_arrival(1, dm);
       break;
     }
     case BATCHED_OPEN_WF_PREDICATES_4: // [rount 2] wait
     {
-      if (msg_reception_status[1][dm.sender_id-1]) // TODO: map dm.sender_id to a x-value
+      if (dm.block_idx != wf_level+1 || msg_reception_status[1].empty() || msg_reception_status[1][dm.sender_id-1]) // TODO: map dm.sender_id to a x-value
       {
         break; // we will ingonre the current dm message
       }
-      for(size_t i = 0 ; i != num_blocks1 ; i++)
+      for(size_t i = 0 ; !dm.in_place && i != wf_blocks ; i++)
       {
         ret_open_exp_shares1[i][dm.sender_id-1] = dm.body[0][i];
       }
       msg_reception_status[1][dm.sender_id-1] = true;
+      record_peer_arrival(2, dm);
       break;
     }
     case BATCHED_OPEN_SUMS_OF_POWERS_6: // [rount 3] wait
@@ -480,11 +969,12 @@ void rm_mixing_stm::message_handler(
       {
         break; // we will ingonre the current dm message
       }
-      for(size_t i = 0 ; i != num_blocks1 ; i++)
+      for(size_t i = 0 ; !dm.in_place && i != num_blocks1 ; i++)
       {
         rec_exp_shares1[i][dm.sender_id-1] = dm.body[0][i];
       }
       msg_reception_status[2][dm.sender_id-1] = true;
+      record_peer_arrival(3, dm);
       break;
     }
     case BATCHED_OPEN_SUMS_OF_POWERS_8: // [round 4] wait
@@ -493,16 +983,17 @@ void rm_mixing_stm::message_handler(
       {
         break; // we will ingonre the current dm message
       }
-      for(size_t i = 0 ; i != num_blocks1 ; i++)
+      for(size_t i = 0 ; !dm.in_place && i != num_blocks1 ; i++)
       {
         ret_open_exp_shares2[i][dm.sender_id-1] = dm.body[0][i];
       }
       msg_reception_status[3][dm.sender_id-1] = true;
+      record_peer_arrival(4, dm);
       break;
     }
     default:
     {
-      cout << "MSG HANDLER ERROR: Message for Undefined State Received: " << dm.mixing_state_id << endl;
+      RM_LOG_ERROR("MSG HANDLER ERROR: Message for Undefined State Received: " << dm.mixing_state_id);
       break;
     }
   }
@@ -525,7 +1016,7 @@ void rm_mixing_stm::execute_rm_stm(
         if(client_msg_counter == info.N)
         {
           //std::cout << "STM State: All " << info.N << " client messages are recieved\n";
-          std::cout << "[*****]: N = " << info.N << ", Prime = " << NTL::NumBits(info.fft_prime_info.prime) << std::endl;
+          RM_LOG_INFO("[*****]: N = " << info.N << ", Prime = " << NTL::NumBits(info.fft_prime_info.prime));
           client_msg_counter = 0; // initialize the counter
           stm_state = COMPUTE_WELLFORMEDNESS_PREDICATES;
           //std::cout << "MOVING TO THE WF VERIFICATION\n";
@@ -551,7 +1042,9 @@ void rm_mixing_stm::execute_rm_stm(
 
         end_tick = chrono::steady_clock::now();
         auto lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
-        std::cout <<  "[COMWF time]: " << lapsed << "\n";
+        RM_LOG_INFO("[COMWF time]: " << lapsed);
+        timings.comwf = lapsed;
+        record_stage("COMWF", lapsed);
 
         stm_state = BATCHED_OPEN_WF_PREDICATES_1;
         break;
@@ -559,9 +1052,30 @@ void rm_mixing_stm::execute_rm_stm(
       case BATCHED_OPEN_WF_PREDICATES_1: // [Round 1] expand/send preds
       {
         //std::cout << "STM State: [Round 1] Batch Open Predicates\n";
-        batched_open_expand_send(clients, info, preds, num_blocks1, size_last1,1);
+        if (wf_level != 0) // another pass over split groups
+        {
+          msg_reception_status[0].assign(info.n, false);
+          msg_reception_status[1].assign(info.n, false);
+          if (!opens_in_one_round(info))
+          {
+            ret_open_exp_shares1.SetLength(wf_blocks);
+            for(size_t i = 0 ; i != wf_blocks ; i++)
+            {
+              ret_open_exp_shares1[i].SetLength(info.n);
+            }
+          }
+          std::deque<rm_net::deserialized_message> pending;
+          pending.swap(wf_pending);
+          for (auto& dm : pending)
+          {
+            message_handler(dm, info);
+          }
+        }
+        register_round_buffers(rec_exp_shares1, 1, wf_blocks, info);
+        batched_open_expand_send(clients, info, preds, wf_blocks, wf_size_last, 1);
         stm_state = BATCHED_OPEN_WF_PREDICATES_2;
         preds.kill(); // release memory
+        round_start_tick = chrono::steady_clock::now();
         flag = false; // stop the stm and wait for shares from other servers
         break;
       }
@@ -570,11 +1084,20 @@ void rm_mixing_stm::execute_rm_stm(
         if(is_all_true(msg_reception_status[0]))
         {
           //std::cout << "STM State: [Round 1] All messages are recieved\n";
-          assert(rec_exp_shares1.length() == num_blocks1);
-          for(size_t i = 0 ; i != num_blocks1 ; i++){
-            assert(rec_exp_shares1.at(i).length() == info.n);
+          release_round_buffers(BATCHED_OPEN_WF_PREDICATES_2); // late duplicates go through the queue
+          assert(static_cast<size_t>(rec_exp_shares1.length()) == num_blocks1);
+          for(size_t i = 0 ; i != wf_blocks ; i++){
+            assert(static_cast<size_t>(rec_exp_shares1.at(i).length()) == info.n);
           }
           msg_reception_status[0].clear();
+          timings.round_wait[0] = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - round_start_tick).count();
+          record_round_wait(1);
+          if (opens_in_one_round(info))
+          {
+            decode_received_shares(opened_values, info, wf_blocks);
+            stm_state = OPEN_CHECK_WF_PREDICATES;
+            break;
+          }
           stm_state = BATCHED_OPEN_WF_PREDICATES_3; // proceed to the next state
           break;
         }
@@ -588,9 +1111,11 @@ void rm_mixing_stm::execute_rm_stm(
       {
         //std::cout << "STM State: [Round 2] Reconstruct/Send Expanded Predicate Openings to all\n";
         
-        open_exp_shares_to_all(clients, info, ret_open_exp_shares1, num_blocks1, 2);
+        register_round_buffers(ret_open_exp_shares1, 2, wf_blocks, info);
+        open_exp_shares_to_all(clients, info, ret_open_exp_shares1, wf_blocks, 2);
         
         stm_state = BATCHED_OPEN_WF_PREDICATES_4; // proceed to the next state
+        round_start_tick = chrono::steady_clock::now();
         flag = false; // stop the stm and wait for shares from other servers
         break;
       }
@@ -599,8 +1124,11 @@ void rm_mixing_stm::execute_rm_stm(
         if(is_all_true(msg_reception_status[1]))
         {
           //std::cout << "STM State: [Round 2] All Openned Expanded Predicate Shares Returned\n";
+          release_round_buffers(BATCHED_OPEN_WF_PREDICATES_4);
           stm_state = OPEN_CHECK_WF_PREDICATES; // proceed to the next state
           msg_reception_status[1].clear();
+          timings.round_wait[1] = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - round_start_tick).count();
+          record_round_wait(2);
           break;
         }
         else 
@@ -614,25 +1142,52 @@ void rm_mixing_stm::execute_rm_stm(
         //std::cout << "STM State: Reconstruct and Verify WF Predicates\n";
         vec_ZZ_p output_preds;
 
-        reconstruct_batched_shares(
-            output_preds, 
-            ret_open_exp_shares1, 
-            info, 
-            num_blocks1, 
-            size_last1);
+        if (opens_in_one_round(info))
+        {
+          output_preds.swap(opened_values);
+        }
+        else
+        {
+          reconstruct_batched_shares(
+              output_preds, 
+              ret_open_exp_shares1, 
+              info, 
+              wf_blocks, 
+              wf_size_last);
+        }
 
-        for(size_t i = 0 ; i != info.N ; i++)
+        if (info.wf_groups != 0)
+        {
+          assert(static_cast<size_t>(output_preds.length()) >= wf_open_groups.size());
+          split_wf_groups(output_preds, corr_clients);
+          if (!wf_open_groups.empty())
+          {
+            wf_level++;
+            static metric_counter& split_passes = rm_metrics().counter("rm_wf_split_passes_total", "Extra well-formedness passes over split groups");
+            split_passes.inc();
+            aggregate_wf_groups(info);
+            stm_state = BATCHED_OPEN_WF_PREDICATES_1;
+            break;
+          }
+          client_preds.kill();
+        }
+        else
         {
-          if(output_preds[i] != 0)
+          for(size_t i = 0 ; i != info.N ; i++)
           {
-            corr_clients->at(i) = true;
+            if(output_preds[i] != 0)
+            {
+              corr_clients->at(i) = true;
+            }
           }
+          assert(static_cast<size_t>(output_preds.length()) == info.N);
         }
-        assert(output_preds.length() == info.N);
 
         wf_end_tick = chrono::steady_clock::now();
         auto wf_lapsed = std::chrono::duration<double, std::milli> (wf_end_tick - wf_start_tick).count();
-        std::cout << "[E2EWF time]: " << wf_lapsed << "\n";
+        RM_LOG_INFO("[E2EWF time]: " << wf_lapsed);
+        timings.e2ewf = wf_lapsed;
+        record_stage("E2EWF", wf_lapsed);
 
         stm_state = DECOMPRESS_CLIENT_INPUTS; // proceed to the next state 
         break;
@@ -645,11 +1200,24 @@ void rm_mixing_stm::execute_rm_stm(
         std::chrono::steady_clock::time_point end_tick;
         start_tick = chrono::steady_clock::now();
 
-        decompress_input_encodings(info, corr_clients);
+        // with speculation, only the wait for the worker and the corrupted clients remain
+        if (!finish_speculation(info, corr_clients))
+        {
+          if (info.rns_mode)
+          {
+            load_rns_inputs(info, corr_clients);
+          }
+          else
+          {
+            decompress_input_encodings(info, corr_clients);
+          }
+        }
 
         end_tick = chrono::steady_clock::now();
         auto lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
-        std::cout << "[DECOM time]: " << lapsed << "\n";
+        RM_LOG_INFO("[DECOM time]: " << lapsed);
+        timings.decom = lapsed;
+        record_stage("DECOM", lapsed);
 
         stm_state = COMPUTE_SUM_OF_POWERS; 
         break;
@@ -662,11 +1230,25 @@ void rm_mixing_stm::execute_rm_stm(
         std::chrono::steady_clock::time_point end_tick;
         start_tick = chrono::steady_clock::now();
 
-        compute_sums_of_powers(info);
+        if (info.rns_mode)
+        {
+          compute_rns_sums_of_powers(info);
+        }
+        else if (spec_sums.length() != 0)
+        {
+          shared_sums_of_powers.swap(spec_sums); // summed by the speculative worker
+          spec_sums.kill();
+        }
+        else
+        {
+          compute_sums_of_powers(info);
+        }
 
         end_tick = chrono::steady_clock::now();
         auto lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
-        std::cout << "[SOPOW time]: " << lapsed << "\n";
+        RM_LOG_INFO("[SOPOW time]: " << lapsed);
+        timings.sopow = lapsed;
+        record_stage("SOPOW", lapsed);
 
         stm_state = BATCHED_OPEN_SUMS_OF_POWERS_5; 
         break;
@@ -674,9 +1256,11 @@ void rm_mixing_stm::execute_rm_stm(
       case BATCHED_OPEN_SUMS_OF_POWERS_5:  // [round 3] expand/send shares
       {
         //std::cout << "STM State: [Round 3] Batch Open Shared Sums of Powers\n";
+        register_round_buffers(rec_exp_shares1, 3, num_blocks1, info);
         batched_open_expand_send(clients, info, shared_sums_of_powers, num_blocks1, size_last1,3);
         shared_sums_of_powers.kill(); // release memeory after sending all
         stm_state = BATCHED_OPEN_SUMS_OF_POWERS_6; 
+        round_start_tick = chrono::steady_clock::now();
         flag = false; 
         break;
       }
@@ -685,6 +1269,15 @@ void rm_mixing_stm::execute_rm_stm(
         if(is_all_true(msg_reception_status[2]))
         {
           //std::cout << "STM State: [Round 3] All Expanded SOPs Shares Received\n";
+          release_round_buffers(BATCHED_OPEN_SUMS_OF_POWERS_6);
+          timings.round_wait[2] = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - round_start_tick).count();
+          record_round_wait(3);
+          if (opens_in_one_round(info))
+          {
+            decode_received_shares(opened_values, info, num_blocks1);
+            stm_state = COMPUTE_NEWTON_ID_AND_FIND_ROOTS;
+            break;
+          }
           stm_state = BATCHED_OPEN_SUMS_OF_POWERS_7; // proceed to the next state
           break;
         }
@@ -697,8 +1290,10 @@ void rm_mixing_stm::execute_rm_stm(
       case BATCHED_OPEN_SUMS_OF_POWERS_7: // round 4: open to all
       {
         //std::cout << "STM State: [Round 4] Reconstruct/Send Expanded Sums of Power Openings to all\n";
+        register_round_buffers(ret_open_exp_shares2, 4, num_blocks1, info);
         open_exp_shares_to_all(clients, info, ret_open_exp_shares2, num_blocks1, 4);
         stm_state = BATCHED_OPEN_SUMS_OF_POWERS_8; 
+        round_start_tick = chrono::steady_clock::now();
         flag = false; 
         break;
       }
@@ -707,6 +1302,9 @@ void rm_mixing_stm::execute_rm_stm(
         if(is_all_true(msg_reception_status[3]))
         {
           //std::cout << "STM State: [Round 4] All Expanded SOP Openings Returned\n";
+          release_round_buffers(BATCHED_OPEN_SUMS_OF_POWERS_8);
+          timings.round_wait[3] = std::chrono::duration<double, std::milli> (chrono::steady_clock::now() - round_start_tick).count();
+          record_round_wait(4);
           stm_state = COMPUTE_NEWTON_ID_AND_FIND_ROOTS; // proceed to the next state
           break;
         }
@@ -724,12 +1322,19 @@ void rm_mixing_stm::execute_rm_stm(
         NTL::vec_ZZ_p rm_output;
 
         // reconstruct all sums of powers
-        reconstruct_batched_shares(
-          sums_of_powers,
-          ret_open_exp_shares2, 
-          info, 
-          num_blocks1, 
-          size_last1);
+        if (opens_in_one_round(info))
+        {
+          sums_of_powers.swap(opened_values);
+        }
+        else
+        {
+          reconstruct_batched_shares(
+            sums_of_powers,
+            ret_open_exp_shares2, 
+            info, 
+            num_blocks1, 
+            size_last1);
+        }
         
         sym_poly.SetLength(info.N+1);
 
@@ -743,7 +1348,9 @@ void rm_mixing_stm::execute_rm_stm(
 
         end_tick = chrono::steady_clock::now();
         auto lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
-        std::cout << "[NEWID Time]: " << lapsed << "\n";
+        RM_LOG_INFO("[NEWID Time]: " << lapsed);
+        timings.newid = lapsed;
+        record_stage("NEWID", lapsed);
 
         // find the roots of the symmetric polynomial and complete the mixing stm.
         start_tick = chrono::steady_clock::now();
@@ -756,13 +1363,21 @@ void rm_mixing_stm::execute_rm_stm(
 
         end_tick = chrono::steady_clock::now();
         lapsed = std::chrono::duration<double, std::milli> (end_tick - start_tick).count();
-        std::cout << "[ROOTF Time]: " << lapsed << "\n";
+        RM_LOG_INFO("[ROOTF Time]: " << lapsed);
+        timings.rootf = lapsed;
+        record_stage("ROOTF", lapsed);
         
         e2e_end_tick = chrono::steady_clock::now();
         auto e2e_lapsed = std::chrono::duration<double, std::milli> (e2e_end_tick - e2e_start_tick).count();
-        std::cout <<  "[RME2E time]: " << e2e_lapsed << "\n";
+        RM_LOG_INFO("[RME2E time]: " << e2e_lapsed);
+        timings.rme2e = e2e_lapsed;
+        record_stage("RME2E", e2e_lapsed);
         
         size_t num_output = rm_output.length();
+        if (outputs != nullptr)
+        {
+          outputs->publish(sid, rm_output, info);
+        }
 
         /*
         std::cout << "*** Output Messages ***\n";
@@ -776,24 +1391,29 @@ void rm_mixing_stm::execute_rm_stm(
         //std::cout << "*** Mixing Completed ***\n";
         stm_state = COMPLETED; 
         flag = false; 
+        // the session's matrices go back to the system in one step
+        client_input.kill();
+        decompressed.kill();
+        arena.release();
+        static metric_counter& completed = rm_metrics().counter("rm_sessions_completed_total", "Mixing sessions completed");
+        completed.inc();
         // notify all clients the completion of mixing for session
         rm_net::message response;
         response.header.sid = sid;
         response.header.mixing_state_id = COMPLETED;
         response.header.sender_id = info.server_id;
-        std::map<uint32_t,std::shared_ptr<rm_net::connection>>::iterator itr;
-        for(itr = rm_client_connections.begin() ; itr != rm_client_connections.end() ; itr++)
+        for(auto& conn : rm_client_connections)
         {
-          if(itr->second->is_connected())
+          if(conn->is_connected())
           {
-            itr->second->send_message(response);
+            conn->send_message(response);
           }
         }
         break;
       }
       default:
       {
-        std::cout << "Undefined State Reached" << endl;
+        RM_LOG_WARN("Undefined State Reached");
         break;
       }
     }
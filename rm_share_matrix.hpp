@@ -0,0 +1,341 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <NTL/ZZ.h>
+#include <NTL/ZZ_p.h>
+#include <NTL/vec_ZZ_p.h>
+#include <NTL/vec_vec_ZZ_p.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "rm_arena.hpp"
+#include "rm_metrics.hpp"
+
+// limbs are read back as native 64-bit words
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "share_matrix requires a little-endian host");
+
+// A contiguous matrix of field elements in fixed-width little-endian limbs.
+// Elements are stored column-major: all rows (clients) of one column
+// (encoding index) are adjacent, and every column starts on a cache line.
+// The storage is either memory or, for matrices larger than RAM, a
+// memory-mapped file that is read back in tiles of rows.
+class share_matrix
+{
+  public:
+    static const size_t cache_line = 64;
+    static const size_t page_size = 4096;
+    static const size_t tile_bytes = 1 << 20; // target size of one tile of rows
+
+    share_matrix() {}
+    share_matrix(const share_matrix&) = delete;
+    share_matrix& operator=(const share_matrix&) = delete;
+    ~share_matrix() { kill(); }
+
+    // allocate a zero-filled rows x cols matrix wide enough for elements mod
+    // prime, from arena if given; arena storage is freed with the arena only
+    void set_dims(size_t rows, size_t cols, const NTL::ZZ& prime, session_arena* arena = nullptr)
+    {
+      kill();
+      num_rows = rows;
+      num_cols = cols;
+      num_limbs = (NTL::NumBytes(prime) + 7) / 8;
+      col_stride = (rows * num_limbs * 8 + cache_line - 1) / cache_line * cache_line;
+      size_t total = col_stride * cols;
+      if (total == 0)
+      {
+        return;
+      }
+      if (arena != nullptr)
+      {
+        data = static_cast<uint64_t*>(arena->allocate(total)); // already zero
+        if (data != nullptr)
+        {
+          in_arena = true;
+          alloc_counter().inc(total);
+          return;
+        }
+        // the arena could not map a chunk; the heap may still have room
+      }
+      data = static_cast<uint64_t*>(std::aligned_alloc(cache_line, total));
+      assert(data != nullptr);
+      std::memset(data, 0, total);
+      alloc_counter().inc(total);
+      live_gauge().add(total);
+    }
+
+    // Allocate a zero-filled rows x cols matrix in a new file at path instead of
+    // memory. The file is unlinked at once, so it lives only as long as the
+    // mapping. Pages written are flushed to it and evicted by the kernel as
+    // needed.
+    bool map_file(size_t rows, size_t cols, const NTL::ZZ& prime, const std::string& path)
+    {
+      kill();
+      size_t limbs = (NTL::NumBytes(prime) + 7) / 8;
+      size_t stride = (rows * limbs * 8 + page_size - 1) / page_size * page_size; // columns on pages of their own
+      size_t total = stride * cols;
+      if (total == 0)
+      {
+        return false;
+      }
+      int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+      if (fd < 0)
+      {
+        return false;
+      }
+      void* addr = MAP_FAILED;
+      if (::ftruncate(fd, total) == 0)
+      {
+        addr = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      ::close(fd);
+      ::unlink(path.c_str());
+      if (addr == MAP_FAILED)
+      {
+        return false;
+      }
+      data = static_cast<uint64_t*>(addr);
+      mapped = true;
+      num_rows = rows;
+      num_cols = cols;
+      num_limbs = limbs;
+      col_stride = stride;
+      mapped_counter().inc(total);
+      return true;
+    }
+
+    // release the storage in one step
+    void kill()
+    {
+      if (data != nullptr && mapped)
+      {
+        ::munmap(data, bytes());
+      }
+      else if (data != nullptr && !in_arena)
+      {
+        live_gauge().add(-static_cast<int64_t>(bytes()));
+        std::free(data);
+      }
+      data = nullptr;
+      mapped = false;
+      in_arena = false;
+      num_rows = 0;
+      num_cols = 0;
+      col_stride = 0;
+    }
+
+    size_t rows() const { return num_rows; }
+    size_t cols() const { return num_cols; }
+    size_t limbs() const { return num_limbs; }
+    size_t bytes() const { return col_stride * num_cols; }
+    bool is_mapped() const { return mapped; }
+
+    // rows per tile: about tile_bytes across all columns, in whole pages of a column
+    size_t tile_rows() const
+    {
+      size_t row_bytes = num_limbs * 8;
+      size_t page_rows = std::max<size_t>(1, page_size / std::max<size_t>(1, row_bytes));
+      size_t rows = tile_bytes / std::max<size_t>(1, row_bytes * num_cols);
+      return std::max<size_t>(1, rows / page_rows) * page_rows;
+    }
+
+    uint64_t* elem(size_t row, size_t col)
+    {
+      return reinterpret_cast<uint64_t*>(reinterpret_cast<unsigned char*>(data) + col * col_stride) + row * num_limbs;
+    }
+
+    const uint64_t* elem(size_t row, size_t col) const
+    {
+      return reinterpret_cast<const uint64_t*>(reinterpret_cast<const unsigned char*>(data) + col * col_stride) + row * num_limbs;
+    }
+
+    void set(size_t row, size_t col, const NTL::ZZ_p& val)
+    {
+      NTL::BytesFromZZ(reinterpret_cast<unsigned char*>(elem(row, col)), NTL::rep(val), num_limbs * 8);
+    }
+
+    void get(NTL::ZZ_p& out, size_t row, size_t col) const
+    {
+      NTL::ZZ temp;
+      NTL::ZZFromBytes(temp, reinterpret_cast<const unsigned char*>(elem(row, col)), num_limbs * 8);
+      NTL::conv(out, temp);
+    }
+
+    // copy a row into out, reusing out's storage when it already has the right length
+    void get_row(NTL::vec_ZZ_p& out, size_t row) const
+    {
+      NTL::ZZ temp;
+      out.SetLength(num_cols);
+      for (size_t j = 0 ; j != num_cols ; j++)
+      {
+        NTL::ZZFromBytes(temp, reinterpret_cast<const unsigned char*>(elem(row, j)), num_limbs * 8);
+        NTL::conv(out[j], temp);
+      }
+    }
+
+    // copy rows [first, first+count) into out, reading each column's run of those rows in turn
+    void get_rows(NTL::vec_vec_ZZ_p& out, size_t first, size_t count) const
+    {
+      assert(first + count <= num_rows);
+      NTL::ZZ temp;
+      out.SetLength(count);
+      for (size_t i = 0 ; i != count ; i++)
+      {
+        out[i].SetLength(num_cols);
+      }
+      for (size_t j = 0 ; j != num_cols ; j++)
+      {
+        const unsigned char* src = reinterpret_cast<const unsigned char*>(elem(first, j));
+        for (size_t i = 0 ; i != count ; i++)
+        {
+          NTL::ZZFromBytes(temp, src + i * num_limbs * 8, num_limbs * 8);
+          NTL::conv(out[i][j], temp);
+        }
+      }
+    }
+
+    // let the kernel evict the whole pages holding only rows [first, first+count)
+    // of a mapped matrix; they are read back from the file if touched again
+    void release_rows(size_t first, size_t count)
+    {
+      if (!mapped)
+      {
+        return;
+      }
+      for (size_t j = 0 ; j != num_cols ; j++)
+      {
+        size_t begin = j * col_stride + first * num_limbs * 8;
+        size_t end = begin + count * num_limbs * 8;
+        begin = (begin + page_size - 1) / page_size * page_size;
+        end = end / page_size * page_size;
+        if (end > begin)
+        {
+          ::madvise(reinterpret_cast<unsigned char*>(data) + begin, end - begin, MADV_DONTNEED);
+        }
+      }
+    }
+
+    void set_row(size_t row, const NTL::vec_ZZ_p& in)
+    {
+      assert(static_cast<size_t>(in.length()) == num_cols);
+      for (size_t j = 0 ; j != num_cols ; j++)
+      {
+        set(row, j, in[j]);
+      }
+    }
+
+    // fill a row straight from a message body written by serialize_from_vec_ZZ_p,
+    // which stores the last element first with nbytes per element. Values are
+    // reduced mod p, as the RNS lanes have no headroom for larger residues.
+    void load_from_wire(size_t row, const unsigned char* body, size_t count, size_t nbytes)
+    {
+      assert(count == num_cols && nbytes <= num_limbs * 8);
+      std::vector<uint64_t> p(num_limbs, 0);
+      NTL::BytesFromZZ(reinterpret_cast<unsigned char*>(p.data()), NTL::ZZ_p::modulus(), num_limbs * 8);
+      for (size_t j = 0 ; j != count ; j++)
+      {
+        unsigned char* dst = reinterpret_cast<unsigned char*>(elem(row, j));
+        std::memcpy(dst, body + (count - 1 - j) * nbytes, nbytes);
+        std::memset(dst + nbytes, 0, num_limbs * 8 - nbytes);
+        if (!below(elem(row, j), p.data()))
+        {
+          NTL::ZZ_p reduced;
+          get(reduced, row, j);
+          set(row, j, reduced);
+        }
+      }
+    }
+
+    // sum a whole column with word-size carries and reduce once at the end
+    void column_sum(NTL::ZZ_p& out, size_t col) const
+    {
+      std::vector<uint64_t> acc(num_limbs + 1, 0);
+      const uint64_t* src = elem(0, col);
+      for (size_t i = 0 ; i != num_rows ; i++)
+      {
+        unsigned __int128 carry = 0;
+        for (size_t k = 0 ; k != num_limbs ; k++)
+        {
+          carry += static_cast<unsigned __int128>(acc[k]) + src[k];
+          acc[k] = static_cast<uint64_t>(carry);
+          carry >>= 64;
+        }
+        acc[num_limbs] += static_cast<uint64_t>(carry);
+        src += num_limbs;
+      }
+      NTL::ZZ temp;
+      NTL::ZZFromBytes(temp, reinterpret_cast<const unsigned char*>(acc.data()), acc.size() * 8);
+      NTL::conv(out, temp);
+    }
+
+  private:
+    // a < b for little-endian numbers of num_limbs limbs
+    bool below(const uint64_t* a, const uint64_t* b) const
+    {
+      for (size_t k = num_limbs ; k-- != 0 ; )
+      {
+        if (a[k] != b[k])
+          return a[k] < b[k];
+      }
+      return false;
+    }
+
+    static metric_counter& alloc_counter()
+    {
+      static metric_counter& c = rm_metrics().counter("rm_alloc_bytes_total", "Bytes allocated for session data", "kind=\"share_matrix\"");
+      return c;
+    }
+
+    static metric_gauge& live_gauge()
+    {
+      static metric_gauge& g = rm_metrics().gauge("rm_live_bytes", "Bytes of session data currently allocated", "kind=\"share_matrix\"");
+      return g;
+    }
+
+    static metric_counter& mapped_counter()
+    {
+      static metric_counter& c = rm_metrics().counter("rm_spilled_bytes_total", "Bytes of session data placed in memory-mapped files");
+      return c;
+    }
+
+    uint64_t* data = nullptr;
+    bool mapped = false; // data is a file mapping rather than heap memory
+    bool in_arena = false; // data belongs to a session_arena
+    size_t num_rows = 0;
+    size_t num_cols = 0;
+    size_t num_limbs = 0;
+    size_t col_stride = 0; // bytes between the starts of two columns
+};
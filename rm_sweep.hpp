@@ -0,0 +1,293 @@
+/*
+#
+# Copyright (C) 2024 Stealth Software Technologies, Inc.
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice (including
+# the next paragraph) shall be included in all copies or
+# substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+#
+*/
+#pragma once
+#include <sys/resource.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rm_common.hpp"
+#include "rm_log.hpp"
+
+// per-stage timings of one mixing session in milliseconds
+struct stage_timings
+{
+  double comwf = 0; // compute well-formedness predicates
+  double e2ewf = 0; // well-formedness check end to end
+  double decom = 0; // decompress client inputs
+  double sopow = 0; // compute sums of powers
+  double newid = 0; // Newton's identities
+  double rootf = 0; // root finding
+  double rme2e = 0; // mixing end to end
+  double round_wait[4] = {0, 0, 0, 0}; // time waiting for peers in each network round
+};
+
+// a sweep is a list of (prime bits, L) cases, each run warmup + reps times
+struct sweep_config
+{
+  std::vector<std::pair<int,int>> cases;
+  size_t warmup = 0;
+  size_t reps = 1;
+  std::string results_prefix = "logs/results";
+};
+
+// one session of a sweep; its sid is its index in the run list
+struct sweep_run
+{
+  rm_info info;
+  size_t case_idx;
+  size_t rep;
+  bool warmup;
+};
+
+// the compile-time test matrix of rm_common.hpp
+void default_sweep_cases(sweep_config& config)
+{
+  for(size_t L_idx = 0 ; L_idx != L_value.size() ; L_idx++)
+  {
+    for(size_t prime_idx = 0 ; prime_idx != prime_length.size() ; prime_idx++)
+    {
+      config.cases.emplace_back(prime_length[prime_idx], L_value[L_idx]);
+    }
+  }
+  for(size_t i = 0 ; i != L_value2.size() ; i++)
+  {
+    config.cases.emplace_back(test_plen, L_value2[i]);
+  }
+}
+
+// Read a sweep file. Each line is one of
+//   primes <bits> ...   | L <L> ...   (the grid of all primes x all L's)
+//   case <bits> <L>                    (a single case)
+//   warmup <count> | reps <count> | results <path prefix>
+// and '#' starts a comment.
+bool read_sweep_file(sweep_config& config, const std::string& filename)
+{
+  std::ifstream fin(filename);
+  if (!fin.is_open())
+  {
+    RM_LOG_ERROR("Reading sweep file failed: " << filename);
+    return false;
+  }
+  std::vector<int> primes;
+  std::vector<int> Ls;
+  std::string line;
+  while (std::getline(fin, line))
+  {
+    line = line.substr(0, line.find('#'));
+    std::stringstream ss(line);
+    std::string key;
+    if (!(ss >> key))
+    {
+      continue;
+    }
+    int value;
+    if (key == "primes")
+    {
+      while (ss >> value) primes.push_back(value);
+    }
+    else if (key == "L")
+    {
+      while (ss >> value) Ls.push_back(value);
+    }
+    else if (key == "case")
+    {
+      int bits, L;
+      if (!(ss >> bits >> L))
+      {
+        RM_LOG_ERROR("Incorrect sweep case: " << line);
+        return false;
+      }
+      config.cases.emplace_back(bits, L);
+    }
+    else if (key == "warmup")
+    {
+      ss >> config.warmup;
+    }
+    else if (key == "reps")
+    {
+      ss >> config.reps;
+    }
+    else if (key == "results")
+    {
+      ss >> config.results_prefix;
+    }
+    else
+    {
+      RM_LOG_ERROR("Unknown sweep key: " << key);
+      return false;
+    }
+  }
+  for (size_t i = 0 ; i != Ls.size() ; i++)
+  {
+    for (size_t j = 0 ; j != primes.size() ; j++)
+    {
+      config.cases.emplace_back(primes[j], Ls[i]);
+    }
+  }
+  return true;
+}
+
+// Apply the sweep options of the mains: --sweep <file>, --case <bits>:<L>,
+// --warmup <count>, --reps <count> and --results <path prefix>. Without any
+// case the compile-time test matrix is used.
+bool configure_sweep(sweep_config& config, const std::multimap<std::string,std::string>& options)
+{
+  auto range = options.equal_range("sweep");
+  for (auto it = range.first ; it != range.second ; it++)
+  {
+    if (!read_sweep_file(config, it->second))
+    {
+      return false;
+    }
+  }
+  range = options.equal_range("case");
+  for (auto it = range.first ; it != range.second ; it++)
+  {
+    size_t colon = it->second.find(':');
+    if (colon == std::string::npos)
+    {
+      RM_LOG_ERROR("Incorrect case, expected <bits>:<L>: " << it->second);
+      return false;
+    }
+    config.cases.emplace_back(std::stoi(it->second.substr(0, colon)), std::stoi(it->second.substr(colon+1)));
+  }
+  if (options.count("warmup")) config.warmup = std::stoul(options.find("warmup")->second);
+  if (options.count("reps")) config.reps = std::stoul(options.find("reps")->second);
+  if (options.count("results")) config.results_prefix = options.find("results")->second;
+  if (config.cases.empty())
+  {
+    default_sweep_cases(config);
+  }
+  return true;
+}
+
+// expand the sweep into sessions; every party must build the same list
+bool build_sweep_runs(std::vector<sweep_run>& runs, const sweep_config& config, rm_info info)
+{
+  for (size_t c = 0 ; c != config.cases.size() ; c++)
+  {
+    if(!fft_prime_from_bit_length(info.fft_prime_info, config.cases[c].first))
+    {
+      RM_LOG_ERROR("Prime Length is Invalid");
+      return false;
+    }
+    info.L = config.cases[c].second; // Mixing parameter L
+    info.N = 14 * pow(info.L, 2) + 10 * info.L - 1; // the number of messages to be mixed
+    info.rns_mode = (config.cases[c].first >= rns_min_prime_bits);
+    for (size_t r = 0 ; r != config.warmup + config.reps ; r++)
+    {
+      runs.push_back({info, c, r, r < config.warmup});
+    }
+    RM_LOG_INFO("[Test Case]: Prime Info -> " << info.fft_prime_info.two_exponent << ", "
+                                 << info.fft_prime_info.odd_factor << ", "
+                                 << info.fft_prime_info.zeta << ", "
+              << "# of Msgs -> " << info.N);
+  }
+  return true;
+}
+
+// peak resident set size of this process in kilobytes
+long peak_rss_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Writes one row per measured session to <prefix>_<party>.csv and
+// <prefix>_<party>.jsonl; localtest.bash merges the files of all parties.
+class results_writer
+{
+  public:
+    bool open(const std::string& prefix, const std::string& party)
+    {
+      role = party;
+      csv.open(prefix + "_" + party + ".csv");
+      json.open(prefix + "_" + party + ".jsonl");
+      if (!csv.is_open() || !json.is_open())
+      {
+        RM_LOG_ERROR("Opening results files failed: " << prefix << "_" << party);
+        return false;
+      }
+      csv << "party,sid,case,rep,prime_bits,L,N,n,rns,"
+          << "COMWF,E2EWF,DECOM,SOPOW,NEWID,ROOTF,RME2E,WAIT1,WAIT2,WAIT3,WAIT4,"
+          << "ENCODE,CLIENTE2E,peak_rss_kb,bytes_sent\n";
+      return true;
+    }
+
+    // a server session: stage timings and bytes sent to peers
+    void write_server(size_t sid, const sweep_run& run, const stage_timings& t, uint64_t bytes_sent)
+    {
+      std::vector<double> v = {t.comwf, t.e2ewf, t.decom, t.sopow, t.newid, t.rootf, t.rme2e,
+                               t.round_wait[0], t.round_wait[1], t.round_wait[2], t.round_wait[3], 0, 0};
+      write(sid, run, v, bytes_sent);
+    }
+
+    // a client session: encoding time per message and end-to-end time
+    void write_client(size_t sid, const sweep_run& run, double encode_ms, double e2e_ms, uint64_t bytes_sent)
+    {
+      std::vector<double> v(13, 0);
+      v[11] = encode_ms;
+      v[12] = e2e_ms;
+      write(sid, run, v, bytes_sent);
+    }
+
+  private:
+    void write(size_t sid, const sweep_run& run, const std::vector<double>& v, uint64_t bytes_sent)
+    {
+      static const char* names[13] = {"COMWF", "E2EWF", "DECOM", "SOPOW", "NEWID", "ROOTF", "RME2E",
+                                      "WAIT1", "WAIT2", "WAIT3", "WAIT4", "ENCODE", "CLIENTE2E"};
+      long bits = NTL::NumBits(run.info.fft_prime_info.prime);
+      long rss = peak_rss_kb();
+      csv << role << "," << sid << "," << run.case_idx << "," << run.rep << "," << bits << ","
+          << run.info.L << "," << run.info.N << "," << run.info.n << "," << run.info.rns_mode;
+      json << "{\"party\":\"" << role << "\",\"sid\":" << sid << ",\"case\":" << run.case_idx
+           << ",\"rep\":" << run.rep << ",\"prime_bits\":" << bits << ",\"L\":" << run.info.L
+           << ",\"N\":" << run.info.N << ",\"n\":" << run.info.n << ",\"rns\":" << run.info.rns_mode;
+      for (size_t i = 0 ; i != v.size() ; i++)
+      {
+        csv << "," << v[i];
+        json << ",\"" << names[i] << "\":" << v[i];
+      }
+      csv << "," << rss << "," << bytes_sent << "\n";
+      json << ",\"peak_rss_kb\":" << rss << ",\"bytes_sent\":" << bytes_sent << "}\n";
+      csv.flush();
+      json.flush();
+    }
+
+    std::string role;
+    std::ofstream csv;
+    std::ofstream json;
+};
@@ -27,6 +27,7 @@
 # SPDX-License-Identifier: MIT
 #
 */
+#pragma once
 #include <NTL/ZZ.h>
 #include <NTL/ZZ_p.h>
 #include <NTL/vector.h>